@@ -0,0 +1,136 @@
+/*
+ * xPL.Arduino v0.1, xPL Implementation for Arduino
+ *
+ * This code is parsing a xPL message stored in 'received' buffer
+ * - isolate and store in 'line' buffer each part of the message -> detection of EOL character (DEC 10)
+ * - analyse 'line', function of its number and store information in xpl_header memory
+ * - check for each step if the message respect xPL protocol
+ * - parse each command line
+ *
+ * Copyright (C) 2012 johan@pirlouit.ch, olivier.lebrun@gmail.com
+ * Original version by Gromain59@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Reassembly benchmark: a large message is sent as fragments by "sender",
+// the fragments are looped back to "receiver" which reassembles them.
+// ENABLE_FRAGMENTATION must be uncommented in xPL.h
+
+#include "xPL.h"
+
+#ifndef ENABLE_FRAGMENTATION
+#error "uncomment ENABLE_FRAGMENTATION in xPL.h"
+#endif
+
+#define BENCHMARK_MESSAGES  100
+#define BENCHMARK_COMMANDS  16
+
+xPL sender;
+xPL receiver;
+
+unsigned int received = 0;
+unsigned long bytes = 0;
+int min_free_ram = 32767;
+
+extern int __heap_start, *__brkval;
+
+int FreeRam()
+{
+  int v;
+  return (int) &v - (__brkval == 0 ? (int) &__heap_start : (int) __brkval);
+}
+
+void Loopback(char *buffer)
+{
+  bytes += strlen(buffer);
+  receiver.ParseInputMessage(buffer);
+
+  int free_ram = FreeRam();
+  if (free_ram < min_free_ram) min_free_ram = free_ram;
+}
+
+void Discard(char *buffer)
+{
+}
+
+void AfterParseAction(xPL_Message * message)
+{
+  if (message->command_count == BENCHMARK_COMMANDS)
+    received++;
+}
+
+void setup()
+{
+  Serial.begin(115200);
+
+  sender.SendExternal = &Loopback;
+  sender.SetSource_P(PSTR("xpl"), PSTR("arduino"), PSTR("sender"));
+
+  receiver.SendExternal = &Discard;
+  receiver.AfterParseAction = &AfterParseAction;
+  receiver.SetSource_P(PSTR("xpl"), PSTR("arduino"), PSTR("receiver"));
+
+  xPL_Message msg;
+
+  msg.hop = 1;
+  msg.type = XPL_STAT;
+  msg.command_max = BENCHMARK_COMMANDS;
+
+  msg.SetTarget_P(PSTR("*"));
+  msg.SetSchema_P(PSTR("sensor"), PSTR("basic"));
+
+  char name[XPL_NAME_LENGTH_MAX+1];
+  char value[XPL_VALUE_LENGTH_MAX+1];
+
+  for (byte i = 0; i < BENCHMARK_COMMANDS; i++)
+  {
+    sprintf_P(name, PSTR("channel%d"), i);
+    sprintf_P(value, PSTR("%d"), 1000 + i);
+    msg.AddCommand(name, value);
+  }
+
+  unsigned long start = micros();
+
+  for (int i = 0; i < BENCHMARK_MESSAGES; i++)
+  {
+    sender.SendMessage(&msg);
+  }
+
+  unsigned long elapsed = micros() - start;
+
+  Serial.print(F("messages reassembled: "));
+  Serial.print(received);
+  Serial.print(F("/"));
+  Serial.println(BENCHMARK_MESSAGES);
+
+  Serial.print(F("us per message: "));
+  Serial.println(elapsed / BENCHMARK_MESSAGES);
+
+  Serial.print(F("bytes per second: "));
+  Serial.println((unsigned long)(bytes * 1000000.0 / elapsed));
+
+  Serial.print(F("reassembly pool high-water mark (bytes): "));
+  Serial.print(receiver.fragment_high_water);
+  Serial.print(F("/"));
+  Serial.println(XPL_FRAGMENT_POOL_MAX * XPL_FRAGMENT_BUFFER_MAX);
+
+  Serial.print(F("min free RAM (bytes): "));
+  Serial.println(min_free_ram);
+}
+
+void loop()
+{
+}
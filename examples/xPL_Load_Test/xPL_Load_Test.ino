@@ -0,0 +1,260 @@
+/*
+ * xPL.Arduino v0.1, xPL Implementation for Arduino
+ *
+ * This code is parsing a xPL message stored in 'received' buffer
+ * - isolate and store in 'line' buffer each part of the message -> detection of EOL character (DEC 10)
+ * - analyse 'line', function of its number and store information in xpl_header memory
+ * - check for each step if the message respect xPL protocol
+ * - parse each command line
+ *
+ * Copyright (C) 2012 johan@pirlouit.ch, olivier.lebrun@gmail.com
+ * Original version by Gromain59@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Load test: a generator builds a configurable mix of xPL messages with
+// xPL_Message and toString, and pushes them in-process through
+// ParseInputMessage. The throughput, the latency percentiles and the
+// memory high-water mark are shown on the serial port.
+
+#include "xPL.h"
+
+// traffic mix
+#define LOAD_MESSAGES          5000
+#define LOAD_SOURCES           50     // number of distinct sources
+#define LOAD_PERCENT_CMND      20     // the rest is split between stat and trig
+#define LOAD_PERCENT_STAT      50
+#define LOAD_PERCENT_BROADCAST 80     // the rest targets this node or another one
+#define LOAD_PERCENT_HBEAT     5      // hbeat.request, broadcast
+#define LOAD_COMMANDS_MIN      1
+#define LOAD_COMMANDS_MAX      6
+
+// latency histogram, log-spaced: 8 buckets per power of two, so a percentile
+// is within 12.5% of the measure, from LOAD_BUCKET_US up to about half a second
+#define LOAD_BUCKET_US         8
+#define LOAD_OCTAVES           13
+#define LOAD_BUCKETS           (8 * (LOAD_OCTAVES + 1) + 1)  // the last bucket holds all the slower messages
+
+struct struct_load_schema
+{
+  const char *class_id;
+  const char *type_id;
+  byte weight;
+};
+
+const char SCHEMA_SENSOR[] PROGMEM = "sensor";
+const char SCHEMA_CONTROL[] PROGMEM = "control";
+const char SCHEMA_X10[] PROGMEM = "x10";
+const char SCHEMA_BASIC[] PROGMEM = "basic";
+
+const struct_load_schema LOAD_SCHEMAS[] =
+{
+  { SCHEMA_SENSOR, SCHEMA_BASIC, 60 },
+  { SCHEMA_CONTROL, SCHEMA_BASIC, 25 },
+  { SCHEMA_X10, SCHEMA_BASIC, 15 },
+};
+
+xPL xpl;
+
+unsigned int histogram[LOAD_BUCKETS];
+unsigned long received = 0;
+int min_free_ram = 32767;
+
+extern int __heap_start, *__brkval;
+
+int FreeRam()
+{
+  int v;
+  return (int) &v - (__brkval == 0 ? (int) &__heap_start : (int) __brkval);
+}
+
+void Discard(char *buffer)
+{
+}
+
+void AfterParseAction(xPL_Message * message)
+{
+  received++;
+
+  int free_ram = FreeRam();
+  if (free_ram < min_free_ram) min_free_ram = free_ram;
+}
+
+// Build the next message of the mix
+void Generate(xPL_Message *_message)
+{
+  char vendor[XPL_VENDOR_ID_MAX+1];
+  char device[XPL_DEVICE_ID_MAX+1];
+  char instance[XPL_INSTANCE_ID_MAX+1];
+  char name[XPL_NAME_LENGTH_MAX+1];
+  char value[XPL_VALUE_LENGTH_MAX+1];
+
+  strcpy_P(vendor, PSTR("xpl"));
+  strcpy_P(device, PSTR("load"));
+  sprintf_P(instance, PSTR("node%d"), (int)random(LOAD_SOURCES));
+  _message->SetSource(vendor, device, instance);
+  _message->hop = 1;
+
+  if (random(100) < LOAD_PERCENT_HBEAT)
+  {
+    _message->type = XPL_CMND;
+    _message->SetTarget_P(PSTR("*"));
+    _message->SetSchema_P(PSTR("hbeat"), PSTR("request"));
+    _message->AddCommand_P(PSTR("command"), PSTR("request"));
+    return;
+  }
+
+  byte percent = random(100);
+  _message->type = percent < LOAD_PERCENT_CMND ? XPL_CMND : percent < LOAD_PERCENT_CMND + LOAD_PERCENT_STAT ? XPL_STAT : XPL_TRIG;
+
+  percent = random(100);
+  if (percent < LOAD_PERCENT_BROADCAST)
+  {
+    _message->SetTarget_P(PSTR("*"));
+  }
+  else if (percent < LOAD_PERCENT_BROADCAST + (100 - LOAD_PERCENT_BROADCAST) / 2)
+  {
+    _message->SetTarget_P(PSTR("xpl"), PSTR("arduino"), PSTR("load"));
+  }
+  else
+  {
+    _message->SetTarget_P(PSTR("xpl"), PSTR("load"), PSTR("node0"));
+  }
+
+  int weight = random(100);
+  byte s = 0;
+  while (s < sizeof(LOAD_SCHEMAS) / sizeof(LOAD_SCHEMAS[0]) - 1 && weight >= LOAD_SCHEMAS[s].weight)
+  {
+    weight -= LOAD_SCHEMAS[s].weight;
+    s++;
+  }
+  _message->SetSchema_P(LOAD_SCHEMAS[s].class_id, LOAD_SCHEMAS[s].type_id);
+
+  byte commands = random(LOAD_COMMANDS_MIN, LOAD_COMMANDS_MAX + 1);
+  for (byte i = 0; i < commands; i++)
+  {
+    sprintf_P(name, PSTR("key%d"), i);
+    sprintf_P(value, PSTR("%ld"), random(100000));
+    _message->AddCommand(name, value);
+  }
+}
+
+// Bucket of a latency: linear below 8 * LOAD_BUCKET_US, then 8 buckets per power of two
+unsigned int Bucket(unsigned long _us)
+{
+  unsigned long v = _us / LOAD_BUCKET_US;
+  if (v < 8)
+    return v;
+
+  byte e = 3;
+  while (e < 31 && (v >> (e + 1)) != 0) e++;
+
+  unsigned int bucket = (e - 2) * 8 + ((v >> (e - 3)) & 7);
+  return bucket < LOAD_BUCKETS - 1 ? bucket : LOAD_BUCKETS - 1;
+}
+
+// Upper bound, in us, of a bucket but the last one
+unsigned long BucketLimit(unsigned int _bucket)
+{
+  if (_bucket < 8)
+    return (unsigned long)(_bucket + 1) * LOAD_BUCKET_US;
+
+  return ((unsigned long)(9 + _bucket % 8) << (_bucket / 8 - 1)) * LOAD_BUCKET_US;
+}
+
+// Print the latency, in us, of the "_permil" per thousand fastest messages
+void PrintPercentile(unsigned int _permil)
+{
+  unsigned long threshold = (unsigned long)LOAD_MESSAGES * _permil / 1000;
+  unsigned long count = 0;
+  unsigned int b = 0;
+
+  for (; b < LOAD_BUCKETS - 1; b++)
+  {
+    count += histogram[b];
+    if (count >= threshold)
+      break;
+  }
+
+  if (b == LOAD_BUCKETS - 1)
+  {
+    // slower than the histogram can tell
+    Serial.print(F(">"));
+    Serial.print(BucketLimit(LOAD_BUCKETS - 2));
+  }
+  else
+  {
+    Serial.print(BucketLimit(b));
+  }
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  randomSeed(analogRead(0));
+
+  xpl.SendExternal = &Discard;
+  xpl.AfterParseAction = &AfterParseAction;
+  xpl.SetSource_P(PSTR("xpl"), PSTR("arduino"), PSTR("load"));
+
+  unsigned long bytes = 0;
+  unsigned long busy = 0;
+
+  for (unsigned int i = 0; i < LOAD_MESSAGES; i++)
+  {
+    xPL_Message msg;
+    Generate(&msg);
+
+    char *buffer = msg.toString();
+    bytes += strlen(buffer);
+
+    unsigned long start = micros();
+    xpl.ParseInputMessage(buffer);
+    xpl.Process();
+    unsigned long elapsed = micros() - start;
+
+    free(buffer);
+
+    busy += elapsed;
+    histogram[Bucket(elapsed)]++;
+  }
+
+  Serial.print(F("messages: "));
+  Serial.print(received);
+  Serial.print(F("/"));
+  Serial.println(LOAD_MESSAGES);
+
+  Serial.print(F("messages per second: "));
+  Serial.println((unsigned long)(LOAD_MESSAGES * 1000000.0 / busy));
+
+  Serial.print(F("bytes per second: "));
+  Serial.println((unsigned long)(bytes * 1000000.0 / busy));
+
+  Serial.print(F("latency p50/p99/p99.9 (us): "));
+  PrintPercentile(500);
+  Serial.print(F("/"));
+  PrintPercentile(990);
+  Serial.print(F("/"));
+  PrintPercentile(999);
+  Serial.println();
+
+  Serial.print(F("min free RAM (bytes): "));
+  Serial.println(min_free_ram);
+}
+
+void loop()
+{
+}
@@ -64,6 +64,7 @@ void AfterParseAction(xPL_Message * message)
 void setup()
 {
   Serial.begin(115200);
+  randomSeed(analogRead(0));  // spread the answers to hbeat.request
   Ethernet.begin(mac,ip);
   Udp.begin(xpl.udp_port);  
   
@@ -0,0 +1,137 @@
+/*
+ * xPL.Arduino v0.1, xPL Implementation for Arduino
+ *
+ * This code is parsing a xPL message stored in 'received' buffer
+ * - isolate and store in 'line' buffer each part of the message -> detection of EOL character (DEC 10)
+ * - analyse 'line', function of its number and store information in xpl_header memory
+ * - check for each step if the message respect xPL protocol
+ * - parse each command line
+ *
+ * Copyright (C) 2012 johan@pirlouit.ch, olivier.lebrun@gmail.com
+ * Original version by Gromain59@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Worst-case parsing benchmark: each input, valid or adversarial, is parsed
+// BENCHMARK_ITERATIONS times and the max and 99.9th percentile of the cycles
+// per packet are shown on the serial port.
+
+#include "xPL.h"
+
+#define BENCHMARK_ITERATIONS  2000
+#define BENCHMARK_TOP         (BENCHMARK_ITERATIONS / 1000 + 1)  // largest samples kept, the last one is the p99.9
+
+#define BENCHMARK_CASES       6
+
+xPL xpl;
+
+const char XPL_BENCHMARK_HEADER[] PROGMEM = "xpl-stat\n{\nhop=1\nsource=xpl-arduino.bench\ntarget=*\n}\nsensor.basic\n{\n";
+
+void Discard(char *buffer)
+{
+}
+
+// Fill the buffer with the input of a case, return its name
+const __FlashStringHelper *BuildCase(byte _case, char *_buffer)
+{
+  int size = XPL_MESSAGE_BUFFER_MAX - 1;
+
+  switch (_case)
+  {
+    case 0:
+      strcpy_P(_buffer, XPL_BENCHMARK_HEADER);
+      strcat_P(_buffer, PSTR("device=1\ntype=temp\ncurrent=22\n}\n"));
+      return F("valid sensor.basic");
+
+    case 1:
+      memset(_buffer, 'a', size);
+      _buffer[size] = '\0';
+      return F("one long line, no newline");
+
+    case 2:
+      memset(_buffer, '\n', size);
+      _buffer[size] = '\0';
+      return F("newlines only");
+
+    case 3:
+      strcpy_P(_buffer, XPL_BENCHMARK_HEADER);
+      for (int i = strlen(_buffer); i + 4 <= size; i += 4)
+      {
+        strcpy_P(_buffer + i, PSTR("a=b\n"));
+      }
+      return F("many short commands");
+
+    case 4:
+      strcpy_P(_buffer, XPL_BENCHMARK_HEADER);
+      for (int i = strlen(_buffer); i < size - 1; i++)
+      {
+        _buffer[i] = 'x';
+      }
+      _buffer[size - 1] = '\n';
+      _buffer[size] = '\0';
+      return F("body line too long");
+
+    default:
+      strcpy_P(_buffer, XPL_BENCHMARK_HEADER);
+      strcat_P(_buffer, PSTR("device=1\n"));
+      return F("no end of schema");
+  }
+}
+
+void setup()
+{
+  Serial.begin(115200);
+
+  xpl.SendExternal = &Discard;
+  xpl.SetSource_P(PSTR("xpl"), PSTR("arduino"), PSTR("bench"));
+
+  char buffer[XPL_MESSAGE_BUFFER_MAX];
+
+  for (byte c = 0; c < BENCHMARK_CASES; c++)
+  {
+    const __FlashStringHelper *name = BuildCase(c, buffer);
+    unsigned long top[BENCHMARK_TOP] = { 0 };
+
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+      unsigned long start = micros();
+      xpl.ParseInputMessage(buffer);
+      unsigned long cycles = (micros() - start) * clockCyclesPerMicrosecond();
+
+      // keep the largest samples, in decreasing order
+      for (byte k = 0; k < BENCHMARK_TOP; k++)
+      {
+        if (cycles > top[k])
+        {
+          unsigned long smaller = top[k];
+          top[k] = cycles;
+          cycles = smaller;
+        }
+      }
+    }
+
+    Serial.print(name);
+    Serial.print(F(": max "));
+    Serial.print(top[0]);
+    Serial.print(F(" cycles, p99.9 "));
+    Serial.print(top[BENCHMARK_TOP - 1]);
+    Serial.println(F(" cycles"));
+  }
+}
+
+void loop()
+{
+}
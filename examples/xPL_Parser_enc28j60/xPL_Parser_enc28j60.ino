@@ -62,6 +62,7 @@ void AfterParseAction(xPL_Message * message)
 void setup()
 {
   Serial.begin(115200);
+  randomSeed(analogRead(0));  // spread the answers to hbeat.request
       
   ether.begin(sizeof Ethernet::buffer, mymac);
   ether.staticSetup(myip, gwip);
@@ -88,6 +89,14 @@ void loop()
        xpl.ParseInputMessage(xPLMessageBuff); 
      }
    }
+
+#ifdef ENABLE_TRACE
+   // send 't' on the serial port to dump the trace, in Chrome trace format
+   if (Serial.available() && Serial.read() == 't')
+   {
+     xPL_TraceDump(Serial);
+   }
+#endif
 }
 
 boolean isXpl( uint8_t *buffer)
@@ -0,0 +1,137 @@
+/*
+ * xPL.Arduino v0.1, xPL Implementation for Arduino
+ *
+ * This code is parsing a xPL message stored in 'received' buffer
+ * - isolate and store in 'line' buffer each part of the message -> detection of EOL character (DEC 10)
+ * - analyse 'line', function of its number and store information in xpl_header memory
+ * - check for each step if the message respect xPL protocol
+ * - parse each command line
+ *
+ * Copyright (C) 2012 johan@pirlouit.ch, olivier.lebrun@gmail.com
+ * Original version by Gromain59@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Record the received xPL packets, then replay them through the parser.
+// Send on the serial port:
+//   r : replay at original speed
+//   f : replay as fast as possible, and show the time per packet
+//   c : clear the records
+
+#include <xPL.h>
+#include <xPL_Recorder.h>
+#include <EtherCard.h>
+
+#define RECORDER_LOG_SIZE     2048
+#define RECORDER_INDEX_SIZE   64
+
+byte Ethernet::buffer[XPL_MESSAGE_BUFFER_MAX];
+xPL xpl;
+
+xPL_Recorder recorder;
+byte recorder_log[RECORDER_LOG_SIZE];
+struct_record_index recorder_index[RECORDER_INDEX_SIZE];
+
+uint8_t mymac[6] = { 0x54,0x55,0x58,0x10,0x00,0x11 };
+uint8_t myip[4] = { 192,168,0,133 };
+uint8_t gwip[4] = { 192,168,0,240};
+uint8_t broadcast[4] = { 255,255,255,255};
+
+void SendUdPMessage(char *buffer)
+{
+    ether.sendUdp (buffer, strlen(buffer), xpl.udp_port, broadcast, xpl.udp_port);
+}
+
+void ReceiveAction(char *buffer, xPL_Message * message)
+{
+    recorder.Record(buffer, message);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  randomSeed(analogRead(0));  // spread the answers to hbeat.request
+
+  ether.begin(sizeof Ethernet::buffer, mymac);
+  ether.staticSetup(myip, gwip);
+
+  recorder.Begin(recorder_log, sizeof recorder_log, recorder_index, RECORDER_INDEX_SIZE);
+
+  xpl.SendExternal = &SendUdPMessage;  // pointer to the send callback
+  xpl.ReceiveAction = &ReceiveAction;  // pointer to the record callback
+  xpl.SetSource_P(PSTR("xpl"), PSTR("arduino"), PSTR("recorder")); // parameters for hearbeat message
+}
+
+void loop()
+{
+   xpl.Process();  // heartbeat management
+
+   word len = ether.packetReceive();
+   if( len > 0 )
+   {
+     // Check if Xpl UDP packet
+     if( isXpl( Ethernet::buffer ) )
+     {
+       char xPLMessageBuff[XPL_MESSAGE_BUFFER_MAX];
+       ByteToChar(Ethernet::buffer, xPLMessageBuff, len);
+
+       // parse message
+       xpl.ParseInputMessage(xPLMessageBuff);
+     }
+   }
+
+   if (Serial.available())
+   {
+     char command = Serial.read();
+
+     if (command == 'r')
+     {
+       recorder.Replay(&xpl, true);
+     }
+     else if (command == 'f' && recorder.count > 0)
+     {
+       unsigned long start = micros();
+       recorder.Replay(&xpl, false);
+       unsigned long elapsed = micros() - start;
+
+       Serial.print(recorder.count);
+       Serial.print(F(" packets, us per packet: "));
+       Serial.println(elapsed / recorder.count);
+     }
+     else if (command == 'c')
+     {
+       recorder.Clear();
+     }
+   }
+}
+
+boolean isXpl( uint8_t *buffer)
+{
+  return ( buffer[IP_PROTO_P] == IP_PROTO_UDP_V
+            && buffer[UDP_DST_PORT_L_P] == XPL_PORT_L
+            && buffer[UDP_DST_PORT_H_P] == XPL_PORT_H);
+}
+
+// convert byte* to char*
+void ByteToChar(byte* bytes, char* chars, unsigned int count)
+{
+    unsigned int j = 0;
+    for(unsigned int i = UDP_DATA_P; i < count; i++)
+    {
+    	chars[j++] = (char)bytes[i];
+    }
+    chars[j] = '\0';
+}
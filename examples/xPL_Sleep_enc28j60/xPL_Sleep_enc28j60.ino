@@ -0,0 +1,117 @@
+/*
+ * xPL.Arduino v0.1, xPL Implementation for Arduino
+ *
+ * This code is parsing a xPL message stored in 'received' buffer
+ * - isolate and store in 'line' buffer each part of the message -> detection of EOL character (DEC 10)
+ * - analyse 'line', function of its number and store information in xpl_header memory
+ * - check for each step if the message respect xPL protocol
+ * - parse each command line
+ *
+ * Copyright (C) 2012 johan@pirlouit.ch, olivier.lebrun@gmail.com
+ * Original version by Gromain59@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Sleep between xPL events: the CPU sleeps until Process() has something
+// to do or the enc28j60 signals a packet on its INT pin (wired to pin 2).
+// In SLEEP_MODE_IDLE, timer0 keeps millis() running and wakes the CPU once
+// per millisecond, the loop then goes back to sleep at once.
+
+#include <xPL.h>
+#include <EtherCard.h>
+#include <avr/sleep.h>
+
+#define ENC28J60_INT_PIN  2
+
+byte Ethernet::buffer[XPL_MESSAGE_BUFFER_MAX];
+xPL xpl;
+
+uint8_t mymac[6] = { 0x54,0x55,0x58,0x10,0x00,0x11 };
+uint8_t myip[4] = { 192,168,0,133 };
+uint8_t gwip[4] = { 192,168,0,240};
+uint8_t broadcast[4] = { 255,255,255,255};
+
+volatile bool packet_pending = true;
+
+void PacketInterrupt()
+{
+    packet_pending = true;
+}
+
+void SendUdPMessage(char *buffer)
+{
+    ether.sendUdp (buffer, strlen(buffer), xpl.udp_port, broadcast, xpl.udp_port);
+}
+
+void setup()
+{
+  randomSeed(analogRead(0));  // spread the answers to hbeat.request
+  ether.begin(sizeof Ethernet::buffer, mymac);
+  ether.staticSetup(myip, gwip);
+
+  pinMode(ENC28J60_INT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(ENC28J60_INT_PIN), PacketInterrupt, FALLING);
+
+  xpl.SendExternal = &SendUdPMessage;  // pointer to the send callback
+  xpl.SetSource_P(PSTR("xpl"), PSTR("arduino"), PSTR("sleep")); // parameters for hearbeat message
+
+  set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+void loop()
+{
+   // sleep until the next xPL event or a packet
+   while (!packet_pending && xpl.TimeToNextEvent() > 0)
+   {
+     sleep_mode();
+   }
+
+   xpl.Process();  // heartbeat management
+
+   packet_pending = false;
+
+   word len;
+   while ((len = ether.packetReceive()) > 0)
+   {
+     // Check if Xpl UDP packet
+     if( isXpl( Ethernet::buffer ) )
+     {
+       char xPLMessageBuff[XPL_MESSAGE_BUFFER_MAX];
+       ByteToChar(Ethernet::buffer, xPLMessageBuff, len);
+
+       // parse message
+       xpl.ParseInputMessage(xPLMessageBuff);
+     }
+   }
+}
+
+boolean isXpl( uint8_t *buffer)
+{
+  return ( buffer[IP_PROTO_P] == IP_PROTO_UDP_V
+            && buffer[UDP_DST_PORT_L_P] == XPL_PORT_L
+            && buffer[UDP_DST_PORT_H_P] == XPL_PORT_H);
+}
+
+// convert byte* to char*
+void ByteToChar(byte* bytes, char* chars, unsigned int count)
+{
+    unsigned int j = 0;
+    for(unsigned int i = UDP_DATA_P; i < count; i++)
+    {
+    	chars[j++] = (char)bytes[i];
+    }
+    chars[j] = '\0';
+}
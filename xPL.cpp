@@ -27,8 +27,14 @@
  
 #include "xPL.h"
 
+#ifdef ENABLE_CONFIG
+#include <avr/eeprom.h>
+#include <stddef.h>
+#endif
+
 #define XPL_LINE_MESSAGE_BUFFER_MAX			128	// max length of a line			// maximum command in a xpl message
 #define XPL_END_OF_LINE						10
+#define XPL_END_OF_SCHEMA					1	// AnalyseCommandLine found the closing brace
 
 // define the line number identifier
 #define XPL_MESSAGE_TYPE_IDENTIFIER	        1
@@ -57,12 +63,46 @@ xPL::xPL()
   
   SendExternal = NULL;
 
+#ifdef ENABLE_PUBLISH
+  publish_deadband = XPL_DEFAULT_PUBLISH_DEADBAND;
+  publish_max_silence = XPL_DEFAULT_PUBLISH_SILENCE;
+  published_count = 0;
+#endif
+
 #ifdef ENABLE_PARSING
   AfterParseAction = NULL;
+  ReceiveAction = NULL;
 
   last_heartbeat = 0;
+  hbeat_sent = false;
+  next_event = XPL_FIRST_HEARTBEAT_DELAY;
   hbeat_interval = XPL_DEFAULT_HEARTBEAT_INTERVAL;
+  hbeat_reply_delay = XPL_DEFAULT_HBEAT_REPLY_DELAY;
+  hbeat_request_time = 0;
+  hbeat_reply_time = 0;
+  hbeat_reply_pending = false;
   xpl_accepted = XPL_ACCEPT_ALL;
+
+#ifdef ENABLE_REQUEST
+  for (byte i = 0; i < XPL_REQUEST_TABLE_MAX; i++)
+  {
+    requests[i].action = NULL;
+  }
+#endif
+
+#ifdef ENABLE_CONFIG
+  memset(&config, 0, sizeof(config));
+#endif
+
+#ifdef ENABLE_FRAGMENTATION
+  fragment_high_water = 0;
+  fragment_message_id = 0;
+
+  for (byte i = 0; i < XPL_FRAGMENT_POOL_MAX; i++)
+  {
+    fragments[i].part_count = 0;
+  }
+#endif
 #endif
 }
 
@@ -85,7 +125,9 @@ void xPL::SetSource_P(const PROGMEM char * _vendorId, const PROGMEM char * _devi
  */
 void xPL::SendMessage(char *_buffer)
 {
+	XPL_TRACE(XPL_TRACE_SEND, XPL_TRACE_BEGIN, 0);
 	(*SendExternal)(_buffer);
+	XPL_TRACE(XPL_TRACE_SEND, XPL_TRACE_END, 0);
 }
 
 /**
@@ -93,39 +135,212 @@ void xPL::SendMessage(char *_buffer)
  * \details   There is no validation of the message, it is sent as is.
  * \param    message         			An xPL message.
  * \param    _useDefaultSource	if true, insert the default source (defined in SetSource) on the message.
+ * \return   false if the message was dropped because it is too large to be fragmented.
  */
-void xPL::SendMessage(xPL_Message *_message, bool _useDefaultSource)
+bool xPL::SendMessage(xPL_Message *_message, bool _useDefaultSource)
 {
 	if(_useDefaultSource)
 	{
 		_message->SetSource(source.vendor_id, source.device_id, source.instance_id);
 	}
 
+#ifdef ENABLE_FRAGMENTATION
+	// too long, or more commands than a receiver accepts in one message
+	if (_message->Length() >= XPL_MESSAGE_BUFFER_MAX || _message->command_count > XPL_MESSAGE_COMMAND_MAX)
+	{
+		return SendFragments(_message);
+	}
+#endif
+
     char *message_buffer = _message->toString();
     SendMessage(message_buffer);
     free(message_buffer);
 
+    return true;
 }
 
+#ifdef ENABLE_PUBLISH
+/**
+ * \brief       Send an xPL message only if its value changed
+ * \details   The last value sent for each schema and device is kept. The message is sent
+ *                only if the value moved by more than "publish_deadband" or if it was not sent
+ *                for "publish_max_silence" seconds. Otherwise the message is not serialized at all.
+ * \param    message         			An xPL message, usually a xpl-stat.
+ * \param    _device         		    the device the value belongs to.
+ * \param    _value         		        the value carried by the message.
+ * \return   true if the message was sent, false if it was not needed or was dropped by SendMessage.
+ */
+bool xPL::Publish(xPL_Message *_message, const char *_device, long _value)
+{
+	unsigned int key = hashStr(hashSchema(0, &_message->schema), _device);
+	struct_published *entry = FindPublished(key, &_message->schema, _device);
+
+	if (entry->key == key)
+	{
+		long delta = _value - entry->value;
+		if (delta < 0) delta = -delta;
+
+		if (delta <= publish_deadband
+			&& millis() - entry->last_sent < (unsigned long)publish_max_silence * 1000)
+		{
+			return false;
+		}
+	}
+
+	// a dropped message is not recorded, so it is tried again next time
+	if (!SendMessage(_message))
+		return false;
+
+	entry->key = key;
+	entry->schema = _message->schema;
+	strncpy(entry->device, _device, XPL_VALUE_LENGTH_MAX);
+	entry->device[XPL_VALUE_LENGTH_MAX] = '\0';
+	entry->value = _value;
+	entry->last_sent = millis();
+	return true;
+}
+
+/**
+ * \brief       Find the published entry of a schema and a device
+ * \details   If the pair is unknown, return a free entry or the least recently sent one.
+ *                A device longer than XPL_VALUE_LENGTH_MAX is never found, so it is always published.
+ * \param    _key         hash of schema and device
+ * \param    _schema    schema
+ * \param    _device     device
+ */
+struct_published *xPL::FindPublished(unsigned int _key, const struct_xpl_schema *_schema, const char *_device)
+{
+	struct_published *oldest = NULL;
+
+	for (byte i = 0; i < published_count; i++)
+	{
+		// the hash only filters, the schema and the device are compared
+		if (published[i].key == _key
+			&& strcmp(published[i].schema.class_id, _schema->class_id) == 0
+			&& strcmp(published[i].schema.type_id, _schema->type_id) == 0
+			&& strcmp(published[i].device, _device) == 0)
+			return &published[i];
+
+		if (oldest == NULL || millis() - published[i].last_sent > millis() - oldest->last_sent)
+			oldest = &published[i];
+	}
+
+	if (published_count < XPL_PUBLISH_TABLE_MAX)
+	{
+		oldest = &published[published_count++];
+	}
+
+	oldest->key = ~_key;  // not a match until sent
+	return oldest;
+}
+#endif
+
 #ifdef ENABLE_PARSING
 
 /**
  * \brief       xPL Stuff
- * \details   Send heartbeat messages at "hbeat_interval" interval
+ * \details   Send heartbeat messages at "hbeat_interval" interval, answer hbeat.request and check timeouts.
+ *                Returns at once if nothing is due yet, see TimeToNextEvent().
  */
 void xPL::Process()
 {
-	static bool bFirstRun = true;
+	// nothing to do before the next event
+	if ((long)(millis() - next_event) < 0)
+		return;
 
 	// Check heartbeat + send
 	if ((millis()-last_heartbeat >= (unsigned long)hbeat_interval * 1000)
-		  || (bFirstRun && millis() > 3000))
+		  || (!hbeat_sent && millis() >= XPL_FIRST_HEARTBEAT_DELAY))
 	{
 		SendHBeat();
-		bFirstRun = false;
+	}
+
+	// Answer a pending hbeat.request, unless a heartbeat went out since it was received
+	if (hbeat_reply_pending && (long)(millis() - hbeat_reply_time) >= 0)
+	{
+		hbeat_reply_pending = false;
+
+		if (millis() - last_heartbeat > millis() - hbeat_request_time)
+		{
+			SendHBeat();
+		}
+	}
+
+#ifdef ENABLE_REQUEST
+	CheckRequestTimeouts();
+#endif
+
+#ifdef ENABLE_FRAGMENTATION
+	CheckFragmentTimeouts();
+#endif
+
+	ScheduleNextEvent();
+}
+
+/**
+ * \brief       Time before Process() has something to do
+ * \details   Process() does nothing if called earlier, so the caller may sleep (or wait for a packet)
+ *                during this time. A change of "hbeat_interval" is taken into account at the next event.
+ * \return   the delay in ms, 0 if Process() shall be called now.
+ */
+unsigned long xPL::TimeToNextEvent()
+{
+	long remaining = (long)(next_event - millis());
+	return remaining > 0 ? remaining : 0;
+}
+
+/**
+ * \brief       Keep the earliest of the next event and a time
+ */
+void xPL::WakeAt(unsigned long _time)
+{
+	if ((long)(_time - next_event) < 0)
+	{
+		next_event = _time;
 	}
 }
 
+/**
+ * \brief       Find when Process() will have something to do
+ * \details   Earliest of the next heartbeat, the pending hbeat.request answer and the timeouts.
+ */
+void xPL::ScheduleNextEvent()
+{
+	if (hbeat_sent)
+	{
+		next_event = last_heartbeat + (unsigned long)hbeat_interval * 1000;
+	}
+	else
+	{
+		next_event = millis() < XPL_FIRST_HEARTBEAT_DELAY ? XPL_FIRST_HEARTBEAT_DELAY : millis();
+	}
+
+	if (hbeat_reply_pending)
+	{
+		WakeAt(hbeat_reply_time);
+	}
+
+#ifdef ENABLE_REQUEST
+	for (byte i = 0; i < XPL_REQUEST_TABLE_MAX; i++)
+	{
+		if (requests[i].action != NULL)
+		{
+			WakeAt(requests[i].deadline);
+		}
+	}
+#endif
+
+#ifdef ENABLE_FRAGMENTATION
+	for (byte i = 0; i < XPL_FRAGMENT_POOL_MAX; i++)
+	{
+		if (fragments[i].part_count != 0)
+		{
+			WakeAt(fragments[i].started + XPL_FRAGMENT_TIMEOUT);
+		}
+	}
+#endif
+}
+
 /**
  * \brief       Parse an ingoing xPL message
  * \details   Parse a message, check for hearbeat request and call user defined callback for post processing.
@@ -133,22 +348,79 @@ void xPL::Process()
  */
 void xPL::ParseInputMessage(char* _buffer)
 {
+	XPL_TRACE(XPL_TRACE_RECEIVE, XPL_TRACE_BEGIN, 0);
+
 	xPL_Message* xPLMessage = new xPL_Message();
-	Parse(xPLMessage, _buffer);
 
-	// check if the message is an hbeat.request to send a heartbeat
+	XPL_TRACE(XPL_TRACE_PARSE, XPL_TRACE_BEGIN, 0);
+	bool valid = Parse(xPLMessage, _buffer);
+	XPL_TRACE(XPL_TRACE_PARSE, XPL_TRACE_END, 0);
+
+	// let the user record the packet as it was received
+	if(ReceiveAction != NULL)
+	{
+	  (*ReceiveAction)(_buffer, xPLMessage);
+	}
+
+	// a malformed message is dropped
+	if (!valid)
+	{
+		delete xPLMessage;
+		XPL_TRACE(XPL_TRACE_RECEIVE, XPL_TRACE_END, 0);
+		return;
+	}
+
+#ifdef ENABLE_FRAGMENTATION
+	// a fragment is dispatched only when all the fragments of its message are received
+	if (xPLMessage->IsSchema_P(PSTR("fragment"), PSTR("basic")))
+	{
+		xPL_Message* fragment = xPLMessage;
+		xPLMessage = Reassemble(fragment);
+		delete fragment;
+
+		if (xPLMessage == NULL)
+		{
+			XPL_TRACE(XPL_TRACE_RECEIVE, XPL_TRACE_END, 0);
+			return;
+		}
+	}
+#endif
+
+	// check if the message is an hbeat.request to schedule a heartbeat
 	if (CheckHBeatRequest(xPLMessage))
 	{
-		SendHBeat();
+		ScheduleHBeatReply();
+	}
+
+#ifdef ENABLE_CONFIG
+	// answer the config.* requests
+	ProcessConfig(xPLMessage);
+
+	// messages not matching the configured filters are not given to the user
+	if (IsFiltered(xPLMessage))
+	{
+		delete xPLMessage;
+		XPL_TRACE(XPL_TRACE_RECEIVE, XPL_TRACE_END, 0);
+		return;
 	}
+#endif
+
+#ifdef ENABLE_REQUEST
+	// complete the requests waiting for this message
+	DispatchResponse(xPLMessage);
+#endif
 
 	// call the user defined callback to execute an action
 	if(AfterParseAction != NULL)
 	{
+	  XPL_TRACE(XPL_TRACE_CALLBACK, XPL_TRACE_BEGIN, 0);
 	  (*AfterParseAction)(xPLMessage);
+	  XPL_TRACE(XPL_TRACE_CALLBACK, XPL_TRACE_END, 0);
 	}
 
 	delete xPLMessage;
+
+	XPL_TRACE(XPL_TRACE_RECEIVE, XPL_TRACE_END, 0);
 }
 
 /**
@@ -158,6 +430,11 @@ void xPL::ParseInputMessage(char* _buffer)
  */
 bool xPL::TargetIsMe(xPL_Message * _message)
 {
+#ifdef ENABLE_CONFIG
+  if (IsInGroup(_message))
+    return true;
+#endif
+
   if (memcmp(_message->target.vendor_id, source.vendor_id, strlen(source.vendor_id)) != 0)
     return false;
 
@@ -170,29 +447,161 @@ bool xPL::TargetIsMe(xPL_Message * _message)
   return true;
 }
 
+#ifdef ENABLE_REQUEST
+/**
+ * \brief       Send a request and wait for its answer
+ * \details   The message is sent, and "_action" is called from ParseInputMessage with the first
+ *                xpl-stat or xpl-trig coming from the message's target with the expected schema.
+ *                If the request was broadcast, the answer may come from any source.
+ *                If no answer came within "_timeout" ms, "_action" is called from Process() with NULL.
+ * \param    _message         the request, usually a xpl-cmnd.
+ * \param    _classId          class of the expected answer.
+ * \param    _typeId           type of the expected answer.
+ * \param    _action            callback receiving the answer.
+ * \param    _timeout          timeout in ms.
+ * \return   the request id given to "_action", or -1 if too many requests are pending.
+ */
+int xPL::SendRequest_P(xPL_Message *_message, const PROGMEM char *_classId, const PROGMEM char *_typeId, xPLResponseAction _action, unsigned short _timeout)
+{
+	for (byte i = 0; i < XPL_REQUEST_TABLE_MAX; i++)
+	{
+		if (requests[i].action != NULL)
+			continue;
+
+		memcpy_P(requests[i].schema.class_id, _classId, XPL_CLASS_ID_MAX + 1);
+		memcpy_P(requests[i].schema.type_id, _typeId, XPL_TYPE_ID_MAX + 1);
+		requests[i].schema.class_id[XPL_CLASS_ID_MAX] = '\0';
+		requests[i].schema.type_id[XPL_TYPE_ID_MAX] = '\0';
+
+		requests[i].any_source = (memcmp(_message->target.vendor_id, "*", 1) == 0);
+		requests[i].key = hashSchema(0, &requests[i].schema);
+		if (!requests[i].any_source)
+		{
+			requests[i].source = _message->target;
+			requests[i].key = hashId(requests[i].key, &requests[i].source);
+		}
+
+		SendMessage(_message);
+
+		requests[i].deadline = millis() + _timeout;
+		requests[i].action = _action;
+		WakeAt(requests[i].deadline);
+		return i;
+	}
+
+	return -1;
+}
+
+/**
+ * \brief       Forget a pending request, its callback will not be called
+ * \param    _request         the id returned by SendRequest_P
+ */
+void xPL::CancelRequest(byte _request)
+{
+	if (_request < XPL_REQUEST_TABLE_MAX)
+	{
+		requests[_request].action = NULL;
+	}
+}
+
+/**
+ * \brief       Call the callback of the pending requests which timed out
+ */
+void xPL::CheckRequestTimeouts()
+{
+	for (byte i = 0; i < XPL_REQUEST_TABLE_MAX; i++)
+	{
+		if (requests[i].action != NULL && (long)(millis() - requests[i].deadline) >= 0)
+		{
+			xPLResponseAction action = requests[i].action;
+			requests[i].action = NULL;
+			(*action)(i, NULL);
+		}
+	}
+}
+
+/**
+ * \brief       Call the callback of the pending requests answered by the message
+ * \details   The key only rules out most messages cheaply, the schema and source
+ *                are compared before a request is considered answered.
+ * \param    _message         an xPL message
+ */
+void xPL::DispatchResponse(xPL_Message * _message)
+{
+	if (_message->type == XPL_CMND)
+		return;
+
+	unsigned int schema_key = hashSchema(0, &_message->schema);
+	unsigned int source_key = hashId(schema_key, &_message->source);
+
+	for (byte i = 0; i < XPL_REQUEST_TABLE_MAX; i++)
+	{
+		if (requests[i].action == NULL
+			|| requests[i].key != (requests[i].any_source ? schema_key : source_key))
+			continue;
+
+		if (!_message->IsSchema(requests[i].schema.class_id, requests[i].schema.type_id))
+			continue;
+
+		if (!requests[i].any_source
+			&& (strcmp(_message->source.vendor_id, requests[i].source.vendor_id) != 0
+				|| strcmp(_message->source.device_id, requests[i].source.device_id) != 0
+				|| strcmp(_message->source.instance_id, requests[i].source.instance_id) != 0))
+			continue;
+
+		xPLResponseAction action = requests[i].action;
+		requests[i].action = NULL;
+		(*action)(i, _message);
+	}
+}
+#endif
+
 /**
  * \brief       Send a heartbeat message
+ * \details   The interval is sent in minutes, as in config.current.
   */
 void xPL::SendHBeat()
 {
   last_heartbeat = millis();
+  hbeat_sent = true;
   char buffer[XPL_MESSAGE_BUFFER_MAX];
 
-//  sprintf_P(buffer, PSTR("xpl-stat\n{\nhop=1\nsource=%s-%s.%s\ntarget=*\n}\n%s.%s\n{\ninterval=%d\n}\n"), source.vendor_id, source.device_id, source.instance_id, XPL_HBEAT_ANSWER_CLASS_ID, XPL_HBEAT_ANSWER_TYPE_ID, hbeat_interval);
+//  sprintf_P(buffer, PSTR("xpl-stat\n{\nhop=1\nsource=%s-%s.%s\ntarget=*\n}\n%s.%s\n{\ninterval=%u\n}\n"), source.vendor_id, source.device_id, source.instance_id, XPL_HBEAT_ANSWER_CLASS_ID, XPL_HBEAT_ANSWER_TYPE_ID, hbeat_interval / 60);
 
-  sprintf_P(buffer, PSTR("xpl-stat\n{\nhop=1\nsource=%s-%s.%s\ntarget=*\n}\n%s.%s\n{\ninterval=%d\nport=3865\nremote-ip=192.168.4.133\nversion=1.0\n}\n"), source.vendor_id, source.device_id, source.instance_id, XPL_HBEAT_ANSWER_CLASS_ID, XPL_HBEAT_ANSWER_TYPE_ID, hbeat_interval);
+  sprintf_P(buffer, PSTR("xpl-stat\n{\nhop=1\nsource=%s-%s.%s\ntarget=*\n}\n%s.%s\n{\ninterval=%u\nport=3865\nremote-ip=192.168.4.133\nversion=1.0\n}\n"), source.vendor_id, source.device_id, source.instance_id, XPL_HBEAT_ANSWER_CLASS_ID, XPL_HBEAT_ANSWER_TYPE_ID, hbeat_interval / 60);
 
   //(*SendExternal)(buffer);
   SendMessage(buffer);
 }
 
+/**
+ * \brief       Schedule a heartbeat in answer to an hbeat.request
+ * \details   The answer is sent by Process() after a random delay of up to "hbeat_reply_delay" ms,
+ *                so that all the nodes don't answer the same broadcast request at once.
+ *                The hash of the source is mixed into the delay, so nodes running the same firmware
+ *                with an unseeded random() still answer at different times. Sketches should call
+ *                randomSeed() anyway, the same source always gets the same offset.
+ *                Requests received while an answer is already pending are merged into it.
+ */
+void xPL::ScheduleHBeatReply()
+{
+  if (hbeat_reply_pending)
+    return;
+
+  hbeat_request_time = millis();
+  hbeat_reply_time = hbeat_request_time
+    + (hbeat_reply_delay ? (random(hbeat_reply_delay) + hashId(0, &source)) % hbeat_reply_delay : 0);
+  hbeat_reply_pending = true;
+  WakeAt(hbeat_reply_time);
+}
+
 /**
  * \brief       Check if the message is a heartbeat request
   * \param    _message         an xPL message
  */
 inline bool xPL::CheckHBeatRequest(xPL_Message* _message)
 {
-  if (!TargetIsMe(_message))
+  if (!TargetIsMe(_message) && memcmp(_message->target.vendor_id, "*", 1) != 0)  // for me or broadcast
     return false;
 
   return _message->IsSchema(XPL_HBEAT_REQUEST_CLASS_ID, XPL_HBEAT_REQUEST_TYPE_ID);
@@ -200,21 +609,22 @@ inline bool xPL::CheckHBeatRequest(xPL_Message* _message)
 
 /**
  * \brief       Parse a buffer and generate a xPL_Message
- * \details	  Line based xPL parser
+ * \details	  Line based xPL parser. The time spent is bounded by the input: at most XPL_MESSAGE_BUFFER_MAX
+ *                characters are read, each once, and the parsing stops at the first line which is too long,
+ *                at the first invalid header line, or when the message has too many commands.
  * \param    _xPLMessage    the result xPL message
  * \param    _message         the buffer
+ * \return   true if the message is complete and valid.
  */
-void xPL::Parse(xPL_Message* _xPLMessage, char* _buffer)
+bool xPL::Parse(xPL_Message* _xPLMessage, char* _buffer)
 {
-    int len = strlen(_buffer);
-
     byte j=0;
     byte line=0;
     int result=0;
     char lineBuffer[XPL_LINE_MESSAGE_BUFFER_MAX+1];
 
     // read each character of the message
-    for(byte i = 0; i < len; i++)
+    for(int i = 0; i < XPL_MESSAGE_BUFFER_MAX && _buffer[i] != '\0'; i++)
     {
         // load byte by byte in 'line' buffer, until '\n' is detected
         if(_buffer[i] == XPL_END_OF_LINE) // is it a linefeed (ASCII: 10 decimal)
@@ -226,30 +636,38 @@ void xPL::Parse(xPL_Message* _xPLMessage, char* _buffer)
             {
                 // first part: header and schema determination
             	// we analyse the line, function of the line number in the xpl message
+                XPL_TRACE(XPL_TRACE_HEADER, XPL_TRACE_BEGIN, line);
                 result = AnalyseHeaderLine(_xPLMessage, lineBuffer ,line);
-            }
+                XPL_TRACE(XPL_TRACE_HEADER, XPL_TRACE_END, line);
 
-            if(line > XPL_OPEN_SCHEMA)
+                if (result <= 0) return false;  // not an xPL message
+            }
+            else
             {
                 // second part: command line
             	// we analyse the specific command line, function of the line number in the xpl message
+                XPL_TRACE(XPL_TRACE_COMMAND, XPL_TRACE_BEGIN, line-9);
                 result = AnalyseCommandLine(_xPLMessage, lineBuffer, line-9, j);
+                XPL_TRACE(XPL_TRACE_COMMAND, XPL_TRACE_END, line-9);
 
-                if(result == _xPLMessage->command_count+1)
-                    break;
+                if (result == XPL_END_OF_SCHEMA) return true;
+                if (result < 0) return false;
             }
 
-            if (result < 0) break;
-
             j = 0; // reset the buffer pointer
-            clearStr(lineBuffer); // clear the buffer
         }
-        else
+        else if (j < XPL_LINE_MESSAGE_BUFFER_MAX)
         {
             // next character
         	lineBuffer[j++] = _buffer[i];
         }
+        else
+        {
+            return false;  // line too long
+        }
     }
+
+    return false;  // end of schema not found
 }
 
 /**
@@ -258,7 +676,7 @@ void xPL::Parse(xPL_Message* _xPLMessage, char* _buffer)
  * \param    _buffer         	   the line to parse
  * \param    _line         	       the line number
  */
-byte xPL::AnalyseHeaderLine(xPL_Message* _xPLMessage, char* _buffer, byte _line)
+int xPL::AnalyseHeaderLine(xPL_Message* _xPLMessage, char* _buffer, byte _line)
 {
     switch (_line)
     {
@@ -278,6 +696,10 @@ byte xPL::AnalyseHeaderLine(xPL_Message* _xPLMessage, char* _buffer, byte _line)
 				{
 					_xPLMessage->type=XPL_TRIG;  //xpl-trig
 				}
+				else
+				{
+					return -1;  //unknown type
+				}
 			}
 			else
 			{
@@ -302,7 +724,7 @@ byte xPL::AnalyseHeaderLine(xPL_Message* _xPLMessage, char* _buffer, byte _line)
 			break;
 
 		case XPL_HOP_COUNT: //hop
-			if (sscanf_P(_buffer, XPL_HOP_COUNT_PARSER, &_xPLMessage->hop))
+			if (sscanf_P(_buffer, XPL_HOP_COUNT_PARSER, &_xPLMessage->hop) == 1)
 			{
 				return 3;
 			}
@@ -357,8 +779,14 @@ byte xPL::AnalyseHeaderLine(xPL_Message* _xPLMessage, char* _buffer, byte _line)
 			break;
 
 		case XPL_SCHEMA_IDENTIFIER: //schema
-			sscanf_P(_buffer, XPL_SCHEMA_PARSER, &_xPLMessage->schema.class_id, &_xPLMessage->schema.type_id);
-			return 7;
+			if (sscanf_P(_buffer, XPL_SCHEMA_PARSER, &_xPLMessage->schema.class_id, &_xPLMessage->schema.type_id) == 2)
+			{
+				return 7;
+			}
+			else
+			{
+				return -7;
+			}
 
 			break;
 
@@ -383,22 +811,550 @@ byte xPL::AnalyseHeaderLine(xPL_Message* _xPLMessage, char* _buffer, byte _line)
  * \param    _xPLMessage    				   the result xPL message
  * \param    _buffer         	  				   the line to parse
  * \param    _command_line       	       the line number
+ * \return   XPL_END_OF_SCHEMA at the end of the body, 0 for a command, -1 if the message has too many commands
  */
-byte xPL::AnalyseCommandLine(xPL_Message * _xPLMessage, char *_buffer, byte _command_line, byte line_length)
+int xPL::AnalyseCommandLine(xPL_Message * _xPLMessage, char *_buffer, byte _command_line, byte line_length)
 {
     if (memcmp(_buffer,"}",1) == 0) // End of schema
     {
-        return _xPLMessage->command_count+1;
+        return XPL_END_OF_SCHEMA;
     }
     else	// parse the next command
     {
     	struct_command newcmd;
-		
-		sscanf_P(_buffer, XPL_COMMAND_PARSER, &newcmd.name, &newcmd.value);
+    	newcmd.name[0] = '\0';
+    	newcmd.value[0] = '\0';  // "name=" has an empty value
+
+		if (sscanf_P(_buffer, XPL_COMMAND_PARSER, &newcmd.name, &newcmd.value) < 1)
+			return 0;  // not a command, ignored
 
-        _xPLMessage->AddCommand(newcmd.name, newcmd.value);
+        if (!_xPLMessage->AddCommand(newcmd.name, newcmd.value))
+        	return -1;
 
-        return _command_line;
+        return 0;
     }
 }
+
+#if defined(ENABLE_CONFIG) || defined(ENABLE_FRAGMENTATION)
+/**
+ * \brief       Compare two sources or targets
+ */
+static bool IsSameId(const struct_id * _id1, const struct_id * _id2)
+{
+	return strcmp(_id1->vendor_id, _id2->vendor_id) == 0
+		&& strcmp(_id1->device_id, _id2->device_id) == 0
+		&& strcmp(_id1->instance_id, _id2->instance_id) == 0;
+}
+#endif
+
+#ifdef ENABLE_CONFIG
+
+/**
+ * \brief       Check a field of a filter, "*" matches any value
+ */
+static bool IsFieldMatching(const char * _pattern, const char * _field)
+{
+	return (_pattern[0] == '*' && _pattern[1] == '\0') || strcmp(_pattern, _field) == 0;
+}
+
+/**
+ * \brief       Read the configuration saved in EEPROM
+ * \details   The configuration is read as is into "config", then the source and the heartbeat
+ *                interval are set from it. Call after SetSource_P, which gives the identity used
+ *                until the device is configured.
+ * \return   false if no valid configuration is saved.
+ */
+bool xPL::LoadConfig()
+{
+	eeprom_read_block(&config, (const void*)XPL_CONFIG_EEPROM_ADDRESS, sizeof(config));
+
+	if (config.magic != XPL_CONFIG_MAGIC
+		|| config.version != XPL_CONFIG_VERSION
+		|| config.checksum != hashBlock(0, (byte*)&config, offsetof(struct_config, checksum))
+		|| config.filter_count > XPL_CONFIG_FILTER_MAX
+		|| config.group_count > XPL_CONFIG_GROUP_MAX)
+	{
+		memset(&config, 0, sizeof(config));
+		return false;
+	}
+
+	source = config.source;
+	hbeat_interval = config.hbeat_interval;
+	return true;
+}
+
+/**
+ * \brief       Save the configuration in EEPROM
+ * \details   Only the bytes which changed are written.
+ */
+void xPL::SaveConfig()
+{
+	config.magic = XPL_CONFIG_MAGIC;
+	config.version = XPL_CONFIG_VERSION;
+	config.source = source;
+	config.hbeat_interval = hbeat_interval;
+	config.checksum = hashBlock(0, (byte*)&config, offsetof(struct_config, checksum));
+
+	eeprom_update_block(&config, (void*)XPL_CONFIG_EEPROM_ADDRESS, sizeof(config));
+}
+
+/**
+ * \brief       Answer the config.list, config.current and config.response commands
+ * \details   config.list and config.current may be broadcast or sent to a group, config.response
+ *                must target this device by its own source, so that it never renames a whole group.
+ * \param    _message         an xPL message
+ */
+void xPL::ProcessConfig(xPL_Message * _message)
+{
+	if (_message->type != XPL_CMND
+		|| (!TargetIsMe(_message) && memcmp(_message->target.vendor_id, "*", 1) != 0))
+		return;
+
+	if (_message->IsSchema_P(PSTR("config"), PSTR("list")))
+	{
+		SendConfigList();
+	}
+	else if (_message->IsSchema_P(PSTR("config"), PSTR("current")))
+	{
+		SendConfigCurrent();
+	}
+	else if (IsSameId(&_message->target, &source) && _message->IsSchema_P(PSTR("config"), PSTR("response")))
+	{
+		ApplyConfig(_message);
+	}
+}
+
+/**
+ * \brief       Send the list of the configurable options
+ */
+void xPL::SendConfigList()
+{
+	xPL_Message message;
+	char name[XPL_NAME_LENGTH_MAX+1];
+	char value[XPL_VALUE_LENGTH_MAX+1];
+
+	message.hop = 1;
+	message.type = XPL_STAT;
+	message.SetTarget_P(PSTR("*"));
+	message.SetSchema_P(PSTR("config"), PSTR("list"));
+
+	message.AddCommand_P(PSTR("reconf"), PSTR("newconf"));
+	message.AddCommand_P(PSTR("option"), PSTR("interval"));
+
+	strcpy_P(name, PSTR("option"));
+	sprintf_P(value, PSTR("filter[%d]"), XPL_CONFIG_FILTER_MAX);
+	message.AddCommand(name, value);
+	sprintf_P(value, PSTR("group[%d]"), XPL_CONFIG_GROUP_MAX);
+	message.AddCommand(name, value);
+
+	SendMessage(&message);
+}
+
+/**
+ * \brief       Send the current configuration
+ * \details   The interval is in minutes, as defined by the xPL protocol.
+ */
+void xPL::SendConfigCurrent()
+{
+	xPL_Message message;
+	char name[XPL_NAME_LENGTH_MAX+1];
+	char value[XPL_VALUE_LENGTH_MAX+1];
+
+	message.hop = 1;
+	message.type = XPL_STAT;
+	message.SetTarget_P(PSTR("*"));
+	message.SetSchema_P(PSTR("config"), PSTR("current"));
+
+	strcpy_P(name, PSTR("newconf"));
+	message.AddCommand(name, source.instance_id);
+
+	strcpy_P(name, PSTR("interval"));
+	sprintf_P(value, PSTR("%u"), hbeat_interval / 60);
+	message.AddCommand(name, value);
+
+	strcpy_P(name, PSTR("filter"));
+	for (byte i = 0; i < config.filter_count; i++)
+	{
+		struct_config_filter *filter = &config.filter[i];
+		snprintf_P(value, sizeof(value), PSTR("%s.%s.%s.%s.%s.%s"),
+			filter->type == XPL_CMND ? "xpl-cmnd" : filter->type == XPL_STAT ? "xpl-stat" : filter->type == XPL_TRIG ? "xpl-trig" : "*",
+			filter->source.vendor_id, filter->source.device_id, filter->source.instance_id,
+			filter->schema.class_id, filter->schema.type_id);
+		message.AddCommand(name, value);
+	}
+
+	strcpy_P(name, PSTR("group"));
+	for (byte i = 0; i < config.group_count; i++)
+	{
+		sprintf_P(value, PSTR("xpl-group.%s"), config.group[i]);
+		message.AddCommand(name, value);
+	}
+
+	SendMessage(&message);
+}
+
+/**
+ * \brief       Apply a config.response command and save the configuration
+ * \details   The filters (and the groups) of the message replace the current ones.
+ *                A heartbeat is sent with the new identity, the next one follows the new interval.
+ * \param    _message         a config.response message
+ */
+void xPL::ApplyConfig(xPL_Message * _message)
+{
+	bool filter_reset = false;
+	bool group_reset = false;
+
+	for (byte i = 0; i < _message->command_count; i++)
+	{
+		char *name = _message->command[i].name;
+		char *value = _message->command[i].value;
+
+		if (strcmp_P(name, PSTR("newconf")) == 0)
+		{
+			if (value[0] != '\0')
+			{
+				strncpy(source.instance_id, value, XPL_INSTANCE_ID_MAX);
+				source.instance_id[XPL_INSTANCE_ID_MAX] = '\0';
+			}
+		}
+		else if (strcmp_P(name, PSTR("interval")) == 0)
+		{
+			long minutes = strtol(value, NULL, 10);
+			if (minutes > 65535 / 60) minutes = 65535 / 60;  // hbeat_interval is in seconds on 16 bits
+			if (minutes > 0) hbeat_interval = (unsigned short)(minutes * 60);
+		}
+		else if (strcmp_P(name, PSTR("filter")) == 0)
+		{
+			if (!filter_reset)
+			{
+				config.filter_count = 0;
+				filter_reset = true;
+			}
+
+			struct_config_filter *filter = &config.filter[config.filter_count];
+			char type[XPL_VENDOR_ID_MAX+1];
+
+			if (config.filter_count < XPL_CONFIG_FILTER_MAX
+				&& sscanf_P(value, PSTR("%8[^.].%8[^.].%8[^.].%16[^.].%8[^.].%8s"), type,
+					filter->source.vendor_id, filter->source.device_id, filter->source.instance_id,
+					filter->schema.class_id, filter->schema.type_id) == 6)
+			{
+				filter->type = strcmp_P(type, PSTR("xpl-cmnd")) == 0 ? XPL_CMND
+					: strcmp_P(type, PSTR("xpl-stat")) == 0 ? XPL_STAT
+					: strcmp_P(type, PSTR("xpl-trig")) == 0 ? XPL_TRIG : 0;
+				config.filter_count++;
+			}
+		}
+		else if (strcmp_P(name, PSTR("group")) == 0)
+		{
+			if (!group_reset)
+			{
+				config.group_count = 0;
+				group_reset = true;
+			}
+
+			if (config.group_count < XPL_CONFIG_GROUP_MAX && strncmp_P(value, PSTR("xpl-group."), 10) == 0 && value[10] != '\0')
+			{
+				strncpy(config.group[config.group_count], value + 10, XPL_INSTANCE_ID_MAX);
+				config.group[config.group_count][XPL_INSTANCE_ID_MAX] = '\0';
+				config.group_count++;
+			}
+		}
+	}
+
+	SaveConfig();
+	SendHBeat();
+	ScheduleNextEvent();
+}
+
+/**
+ * \brief       Check if the message targets one of my groups (xpl-group.name)
+ * \param    _message         an xPL message
+ */
+bool xPL::IsInGroup(xPL_Message * _message)
+{
+	if (strcmp_P(_message->target.vendor_id, PSTR("xpl")) != 0 || strcmp_P(_message->target.device_id, PSTR("group")) != 0)
+		return false;
+
+	for (byte i = 0; i < config.group_count; i++)
+	{
+		if (strcmp(_message->target.instance_id, config.group[i]) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * \brief       Check if the message is rejected by the configured filters
+ * \details   Without filter, all the messages are accepted.
+ * \param    _message         an xPL message
+ */
+bool xPL::IsFiltered(xPL_Message * _message)
+{
+	if (config.filter_count == 0)
+		return false;
+
+	for (byte i = 0; i < config.filter_count; i++)
+	{
+		struct_config_filter *filter = &config.filter[i];
+
+		if ((filter->type == 0 || filter->type == _message->type)
+			&& IsFieldMatching(filter->source.vendor_id, _message->source.vendor_id)
+			&& IsFieldMatching(filter->source.device_id, _message->source.device_id)
+			&& IsFieldMatching(filter->source.instance_id, _message->source.instance_id)
+			&& IsFieldMatching(filter->schema.class_id, _message->schema.class_id)
+			&& IsFieldMatching(filter->schema.type_id, _message->schema.type_id))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+#endif
+
+#ifdef ENABLE_FRAGMENTATION
+
+/**
+ * \brief       Send a large message as fragment.basic messages
+ * \details   Each fragment holds as many commands as fit in XPL_MESSAGE_BUFFER_MAX.
+ *                The message is dropped if the receiver could not reassemble it: more than
+ *                XPL_FRAGMENT_PARTS_MAX fragments, XPL_FRAGMENT_COMMAND_MAX commands, or a body
+ *                larger than XPL_FRAGMENT_BUFFER_MAX.
+ * \param    _message         an xPL message, with its source set.
+ * \return   false if the message was dropped.
+ */
+bool xPL::SendFragments(xPL_Message *_message)
+{
+	// same limits as Reassemble, which stores the body as "name=value\n" lines
+	unsigned int body_length = 0;
+
+	for (byte i = 0; i < _message->command_count; i++)
+	{
+		body_length += strlen(_message->command[i].name) + 1 + strlen(_message->command[i].value) + 1;
+	}
+
+	if (_message->command_count > XPL_FRAGMENT_COMMAND_MAX || body_length >= XPL_FRAGMENT_BUFFER_MAX)
+		return false;
+
+	xPL_Message fragment;
+	fragment.type = _message->type;
+	fragment.hop = _message->hop;
+	fragment.source = _message->source;
+	fragment.target = _message->target;
+	fragment.SetSchema_P(PSTR("fragment"), PSTR("basic"));
+
+	// fragment without commands, plus "partid=8/8:65535\n" and "schema=class.type\n"
+	unsigned int header_length = fragment.Length() + 17 + 9 + strlen(_message->schema.class_id) + strlen(_message->schema.type_id);
+
+	// first pass: split the commands between the fragments
+	byte first_command[XPL_FRAGMENT_PARTS_MAX + 1];
+	byte part_count = 0;
+	byte i = 0;
+
+	while (i < _message->command_count)
+	{
+		if (part_count == XPL_FRAGMENT_PARTS_MAX)
+			return false;  // too large
+
+		first_command[part_count++] = i;
+
+		unsigned int length = header_length;
+		byte count = 0;
+
+		do
+		{
+			length += strlen(_message->command[i].name) + 1 + strlen(_message->command[i].value) + 1;
+			count++;
+			i++;
+		}
+		while (i < _message->command_count
+			&& count < XPL_MESSAGE_COMMAND_MAX - 2
+			&& length + strlen(_message->command[i].name) + 1 + strlen(_message->command[i].value) + 1 < XPL_MESSAGE_BUFFER_MAX);
+	}
+	first_command[part_count] = _message->command_count;
+
+	// second pass: send the fragments
+	char name[XPL_NAME_LENGTH_MAX + 1];
+	char value[XPL_VALUE_LENGTH_MAX + 1];
+
+	fragment_message_id++;
+
+	for (byte part = 0; part < part_count; part++)
+	{
+		fragment.command_count = 0;
+
+		strcpy_P(name, PSTR("partid"));
+		sprintf_P(value, PSTR("%d/%d:%u"), part + 1, part_count, fragment_message_id);
+		fragment.AddCommand(name, value);
+
+		if (part == 0)
+		{
+			strcpy_P(name, PSTR("schema"));
+			sprintf_P(value, PSTR("%s.%s"), _message->schema.class_id, _message->schema.type_id);
+			fragment.AddCommand(name, value);
+		}
+
+		for (i = first_command[part]; i < first_command[part + 1]; i++)
+		{
+			fragment.AddCommand(_message->command[i].name, _message->command[i].value);
+		}
+
+		// sent as is, a fragment must never be fragmented again
+		char *fragment_buffer = fragment.toString();
+		SendMessage(fragment_buffer);
+		free(fragment_buffer);
+	}
+
+	return true;
+}
+
+/**
+ * \brief       Store a fragment until all the fragments of its message are received
+ * \details   Fragments may arrive in any order. A message which does not fit in the reassembly
+ *                pool, or is not complete within XPL_FRAGMENT_TIMEOUT ms, is dropped.
+ * \param    _fragment         a fragment.basic message
+ * \return   the reassembled message (to delete by the caller), or NULL if it is not complete.
+ */
+xPL_Message *xPL::Reassemble(xPL_Message *_fragment)
+{
+	int part, part_count;
+	unsigned int message_id;
+
+	if (_fragment->command_count == 0
+		|| strcmp_P(_fragment->command[0].name, PSTR("partid")) != 0
+		|| sscanf_P(_fragment->command[0].value, PSTR("%d/%d:%u"), &part, &part_count, &message_id) != 3
+		|| part_count < 1 || part_count > XPL_FRAGMENT_PARTS_MAX || part < 1 || part > part_count)
+	{
+		return NULL;
+	}
+
+	// find the message, or a free entry
+	struct_fragment *entry = NULL;
+
+	for (byte i = 0; i < XPL_FRAGMENT_POOL_MAX; i++)
+	{
+		if (fragments[i].part_count == 0)
+		{
+			if (entry == NULL) entry = &fragments[i];
+		}
+		else if (fragments[i].message_id == message_id && IsSameId(&fragments[i].source, &_fragment->source))
+		{
+			entry = &fragments[i];
+			break;
+		}
+	}
+
+	if (entry == NULL)
+		return NULL;  // pool full
+
+	if (entry->part_count == 0)
+	{
+		entry->started = millis();
+		entry->message_id = message_id;
+		entry->part_count = part_count;
+		entry->part_received = 0;
+		entry->type = _fragment->type;
+		entry->source = _fragment->source;
+		entry->target = _fragment->target;
+		entry->used = 0;
+		WakeAt(entry->started + XPL_FRAGMENT_TIMEOUT);
+	}
+	else if (entry->part_count != part_count || (entry->part_received & (1 << (part - 1))))
+	{
+		return NULL;  // inconsistent or duplicate fragment
+	}
+
+	byte first = 1;
+
+	// the first fragment gives the schema of the message
+	if (part == 1)
+	{
+		if (_fragment->command_count < 2
+			|| strcmp_P(_fragment->command[1].name, PSTR("schema")) != 0
+			|| sscanf_P(_fragment->command[1].value, XPL_SCHEMA_PARSER, &entry->schema.class_id, &entry->schema.type_id) != 2)
+		{
+			entry->part_count = 0;
+			return NULL;
+		}
+		first = 2;
+	}
+
+	entry->part_offset[part - 1] = entry->used;
+
+	for (byte i = first; i < _fragment->command_count; i++)
+	{
+		int length = snprintf_P(entry->body + entry->used, XPL_FRAGMENT_BUFFER_MAX - entry->used, PSTR("%s=%s\n"), _fragment->command[i].name, _fragment->command[i].value);
+
+		if (length >= XPL_FRAGMENT_BUFFER_MAX - entry->used)
+		{
+			entry->part_count = 0;  // too large
+			return NULL;
+		}
+
+		entry->used += length;
+	}
+
+	entry->part_length[part - 1] = entry->used - entry->part_offset[part - 1];
+	entry->part_received |= 1 << (part - 1);
+
+	unsigned int pool_used = 0;
+	for (byte i = 0; i < XPL_FRAGMENT_POOL_MAX; i++)
+	{
+		if (fragments[i].part_count != 0) pool_used += fragments[i].used;
+	}
+	if (pool_used > fragment_high_water) fragment_high_water = pool_used;
+
+	if (entry->part_received != (1 << part_count) - 1)
+		return NULL;
+
+	// all the fragments are received, parse the body in order
+	xPL_Message *message = new xPL_Message();
+	message->command_max = XPL_FRAGMENT_COMMAND_MAX;
+	message->type = entry->type;
+	message->hop = 1;
+	message->source = entry->source;
+	message->target = entry->target;
+	message->schema = entry->schema;
+
+	char lineBuffer[XPL_LINE_MESSAGE_BUFFER_MAX+1];
+
+	for (byte i = 0; i < part_count; i++)
+	{
+		char *line = entry->body + entry->part_offset[i];
+		char *end = line + entry->part_length[i];
+
+		while (line < end)
+		{
+			char *eol = (char*)memchr(line, XPL_END_OF_LINE, end - line);
+			int length = eol - line;
+
+			if (length > XPL_LINE_MESSAGE_BUFFER_MAX) length = XPL_LINE_MESSAGE_BUFFER_MAX;
+			memcpy(lineBuffer, line, length);
+			lineBuffer[length] = '\0';
+
+			AnalyseCommandLine(message, lineBuffer, message->command_count + 1, length);
+			line = eol + 1;
+		}
+	}
+
+	entry->part_count = 0;
+	return message;
+}
+
+/**
+ * \brief       Drop the messages which are not reassembled within XPL_FRAGMENT_TIMEOUT ms
+ */
+void xPL::CheckFragmentTimeouts()
+{
+	for (byte i = 0; i < XPL_FRAGMENT_POOL_MAX; i++)
+	{
+		if (fragments[i].part_count != 0 && millis() - fragments[i].started >= XPL_FRAGMENT_TIMEOUT)
+		{
+			fragments[i].part_count = 0;
+		}
+	}
+}
+#endif
 #endif
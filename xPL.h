@@ -29,16 +29,42 @@
 #define xPL_h
  
 #define ENABLE_PARSING 1
+//#define ENABLE_FRAGMENTATION 1  // send and reassemble messages larger than XPL_MESSAGE_BUFFER_MAX (fragment.basic), needs ENABLE_PARSING
+//#define ENABLE_CONFIG 1  // config.list/current/response support, configuration saved in EEPROM, needs ENABLE_PARSING
+//#define ENABLE_TRACE 1  // record timestamped events of each processing stage, see xPL_Trace.h
+//#define ENABLE_REQUEST 1  // SendRequest_P calls back with the answer of a request or on timeout, needs ENABLE_PARSING
+//#define ENABLE_PUBLISH 1  // Publish sends a value only when it changed, keeps a table of the last values
 
 #include "Arduino.h"
 #include "xPL_utils.h"
 #include "xPL_Message.h"
+#include "xPL_Trace.h"
 
 #define XPL_CMND 1
 #define XPL_STAT 2
 #define XPL_TRIG 3
 
 #define XPL_DEFAULT_HEARTBEAT_INTERVAL   300
+#define XPL_DEFAULT_HBEAT_REPLY_DELAY    3000  // max random delay (ms) before answering an hbeat.request
+#define XPL_FIRST_HEARTBEAT_DELAY        3000  // ms after boot before the first heartbeat
+
+#define XPL_DEFAULT_PUBLISH_DEADBAND     0     // minimum change of a value to publish it again
+#define XPL_DEFAULT_PUBLISH_SILENCE      300   // seconds before an unchanged value is published again
+#define XPL_PUBLISH_TABLE_MAX            4     // number of (schema, device) values remembered
+
+#define XPL_REQUEST_TABLE_MAX            4     // number of requests waiting for an answer
+
+#define XPL_FRAGMENT_POOL_MAX            2     // number of messages reassembled at the same time
+#define XPL_FRAGMENT_BUFFER_MAX          512   // body size of a reassembled message
+#define XPL_FRAGMENT_PARTS_MAX           8     // number of fragments of a message
+#define XPL_FRAGMENT_COMMAND_MAX         40    // number of commands of a reassembled message
+#define XPL_FRAGMENT_TIMEOUT             3000  // ms to receive all the fragments of a message
+
+#define XPL_CONFIG_MAGIC                 0x7850  // marks a configuration saved in EEPROM
+#define XPL_CONFIG_VERSION               1     // version of the configuration saved in EEPROM
+#define XPL_CONFIG_EEPROM_ADDRESS        0     // where the configuration is saved
+#define XPL_CONFIG_FILTER_MAX            2
+#define XPL_CONFIG_GROUP_MAX             2
 
 #define XPL_UDP_PORT 3865
 
@@ -52,6 +78,58 @@ typedef enum {XPL_ACCEPT_ALL, XPL_ACCEPT_SELF, XPL_ACCEPT_SELF_ANY} xpl_accepted
 
 typedef void (*xPLSendExternal)(char*);
 typedef void (*xPLAfterParseAction)(xPL_Message * message);
+typedef void (*xPLReceiveAction)(char * buffer, xPL_Message * message);  // received packet, before dispatch
+typedef void (*xPLResponseAction)(byte request, xPL_Message * message);  // message is NULL on timeout
+
+typedef struct struct_request struct_request;
+struct struct_request			// request waiting for its answer
+{
+    xPLResponseAction action;	// NULL if the entry is free
+    unsigned int key;			// hash of the expected source and schema
+    bool any_source;			// request was broadcast, key is the schema only
+    struct_xpl_schema schema;	// expected schema, checked when the key matches
+    struct_id source;			// expected source, unused if any_source
+    unsigned long deadline;		// millis() at which the request times out
+};
+
+typedef struct struct_fragment struct_fragment;
+struct struct_fragment			// message being reassembled
+{
+    unsigned long started;		// millis() of the first fragment received, 0 if the entry is free
+    unsigned int message_id;
+    byte part_count;
+    byte part_received;			// bit mask of the fragments received
+    short type;
+    struct_id source;
+    struct_id target;
+    struct_xpl_schema schema;	// schema of the reassembled message, from the first fragment
+    int part_offset[XPL_FRAGMENT_PARTS_MAX];
+    int part_length[XPL_FRAGMENT_PARTS_MAX];
+    int used;
+    char body[XPL_FRAGMENT_BUFFER_MAX];  // "name=value\n" lines of the fragments, in order of arrival
+};
+
+typedef struct struct_config_filter struct_config_filter;
+struct struct_config_filter		// "*" in a field matches any value
+{
+    short type;					// XPL_CMND, XPL_STAT, XPL_TRIG, or 0 for any
+    struct_id source;
+    struct_xpl_schema schema;
+};
+
+typedef struct struct_config struct_config;
+struct struct_config			// configuration, saved as is in EEPROM
+{
+    unsigned int magic;			// XPL_CONFIG_MAGIC
+    byte version;				// XPL_CONFIG_VERSION
+    struct_id source;
+    unsigned short hbeat_interval;
+    byte filter_count;
+    struct_config_filter filter[XPL_CONFIG_FILTER_MAX];
+    byte group_count;
+    char group[XPL_CONFIG_GROUP_MAX][XPL_INSTANCE_ID_MAX+1];  // name of the group, without "xpl-group."
+    unsigned int checksum;		// hash of all the previous fields
+};
 
 class xPL
 {
@@ -65,32 +143,97 @@ class xPL
 	xPLSendExternal SendExternal;
 
 	void SendMessage(char *);
-	void SendMessage(xPL_Message *, bool = true);
+	bool SendMessage(xPL_Message *, bool = true);  // false if the message is too large to be sent
 
 	void SetSource_P(const PROGMEM char *,const PROGMEM char *,const PROGMEM char *);  // define my source
 
+#ifdef ENABLE_PUBLISH
+	long publish_deadband;               // default 0, any change is published
+	unsigned short publish_max_silence;  // default 300 s
+
+	bool Publish(xPL_Message *, const char *, long);
+
+  private:
+	struct_published published[XPL_PUBLISH_TABLE_MAX];
+	byte published_count;
+
+	struct_published *FindPublished(unsigned int, const struct_xpl_schema *, const char *);
+#endif
+
 #ifdef ENABLE_PARSING
+  public:
 	xPLAfterParseAction AfterParseAction;
+	xPLReceiveAction ReceiveAction;
 
 
-    byte hbeat_interval;  // default 5
+    unsigned short hbeat_interval;  // default 300 s
+    unsigned short hbeat_reply_delay;  // default 3000 ms, 0 = answer on next Process()
     xpl_accepted_type xpl_accepted;
 
 
     void Process();
     void ParseInputMessage(char *buffer);
+    unsigned long TimeToNextEvent();  // ms before Process() has something to do
 
     bool TargetIsMe(xPL_Message * message);
 
   private:
     //void ClearData();
     unsigned long last_heartbeat;
+    bool hbeat_sent;                   // false until the first heartbeat
+    unsigned long next_event;          // millis() at which Process() has something to do
+    unsigned long hbeat_request_time;  // when the pending hbeat.request was received
+    unsigned long hbeat_reply_time;    // when the pending reply is due
+    bool hbeat_reply_pending;
     void SendHBeat();
+    void ScheduleHBeatReply();
+    void ScheduleNextEvent();
+    void WakeAt(unsigned long);
     bool CheckHBeatRequest(xPL_Message * message);
 
-	void Parse(xPL_Message *, char *);
-	byte AnalyseHeaderLine(xPL_Message *, char *, byte );
-    byte AnalyseCommandLine(xPL_Message *, char *, byte, byte );
+	bool Parse(xPL_Message *, char *);
+	int AnalyseHeaderLine(xPL_Message *, char *, byte );
+    int AnalyseCommandLine(xPL_Message *, char *, byte, byte );
+
+#ifdef ENABLE_REQUEST
+  public:
+    int SendRequest_P(xPL_Message *, const PROGMEM char *, const PROGMEM char *, xPLResponseAction, unsigned short);
+    void CancelRequest(byte);
+
+  private:
+    struct_request requests[XPL_REQUEST_TABLE_MAX];
+    void CheckRequestTimeouts();
+    void DispatchResponse(xPL_Message * message);
+#endif
+
+#ifdef ENABLE_CONFIG
+  public:
+    struct_config config;  // filters and groups, identity and interval when saved
+
+    bool LoadConfig();
+    void SaveConfig();
+
+  private:
+    void ProcessConfig(xPL_Message *);
+    void SendConfigList();
+    void SendConfigCurrent();
+    void ApplyConfig(xPL_Message *);
+    bool IsInGroup(xPL_Message *);
+    bool IsFiltered(xPL_Message *);
+#endif
+
+#ifdef ENABLE_FRAGMENTATION
+  public:
+    unsigned int fragment_high_water;  // max bytes used at once in the reassembly pool
+
+  private:
+    unsigned int fragment_message_id;
+    struct_fragment fragments[XPL_FRAGMENT_POOL_MAX];
+
+    bool SendFragments(xPL_Message *);
+    xPL_Message *Reassemble(xPL_Message *);
+    void CheckFragmentTimeouts();
+#endif
 #endif
 };
 
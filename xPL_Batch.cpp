@@ -0,0 +1,278 @@
+/*
+ * xPL.Arduino v0.1, xPL Implementation for Arduino
+ *
+ * This code is parsing a xPL message stored in 'received' buffer
+ * - isolate and store in 'line' buffer each part of the message -> detection of EOL character (DEC 10)
+ * - analyse 'line', function of its number and store information in xpl_header memory
+ * - check for each step if the message respect xPL protocol
+ * - parse each command line
+ *
+ * Copyright (C) 2012 johan@pirlouit.ch, olivier.lebrun@gmail.com
+ * Original version by Gromain59@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "xPL_Batch.h"
+
+xPL_Batch::xPL_Batch()
+{
+	type = NULL;
+	source_id = NULL;
+	schema_id = NULL;
+	capacity = 0;
+	rows = 0;
+	consumed = 0;
+	column_count = 0;
+}
+
+/**
+ * \brief       Decode the value of a command into a column
+ * \details   Only the selected commands are converted, the others are skipped.
+ *                The values are stored in fixed point: with 1 decimal, "21.5" is stored as 215.
+ *                Extra decimals are truncated. A value which is not a number, or does not fit
+ *                in a long, is stored as XPL_BATCH_BAD_VALUE.
+ * \param    _name         name of the command
+ * \param    _column       the column, of "capacity" rows
+ * \param    _decimals     number of decimals kept
+ * \return   false if XPL_BATCH_COLUMN_MAX columns are already selected.
+ */
+bool xPL_Batch::SelectColumn_P(const PROGMEM char *_name, long *_column, byte _decimals)
+{
+	if (column_count == XPL_BATCH_COLUMN_MAX)
+		return false;
+
+	strncpy_P(column_name[column_count], _name, XPL_NAME_LENGTH_MAX);
+	column_name[column_count][XPL_NAME_LENGTH_MAX] = '\0';
+	value[column_count] = _column;
+	column_decimals[column_count] = _decimals;
+	column_count++;
+	return true;
+}
+
+/**
+ * \brief       Decode many packets into the columns
+ * \details   The packets are decoded in place, without building any xPL_Message. The ids are the
+ *                same hashes as hashId and hashSchema, so they can be compared with the ones of an xPL_Message.
+ *                Malformed packets are skipped. The decoding stops when "capacity" rows are used,
+ *                "consumed" tells where to resume with the next batch.
+ * \param    _packets       the packets.
+ * \param    _count          number of packets.
+ * \return   the number of rows added.
+ */
+int xPL_Batch::Decode(char **_packets, int _count)
+{
+	int first = rows;
+
+	for (consumed = 0; consumed < _count && rows < capacity; consumed++)
+	{
+		if (DecodePacket(_packets[consumed]))
+		{
+			rows++;
+		}
+	}
+
+	return rows - first;
+}
+
+/**
+ * \brief       Hash a line made of fields ("vendor-device.instance" or "class.type"), like hashStr of each field
+ * \param    _line         first character of the line
+ * \param    _end          end of the packet
+ * \param    _separators   separator after each field, but the last one
+ * \return   the character after the end of line, NULL if the line is malformed.
+ */
+static const char *HashFields(const char *_line, const char *_end, const char *_separators, unsigned int *_hash)
+{
+	unsigned int hash = 0;
+
+	for (; _line < _end && *_line != '\n'; _line++)
+	{
+		if (*_separators != '\0' && *_line == *_separators)
+		{
+			_separators++;
+			hash ^= 0xFF;
+		}
+		else
+		{
+			hash ^= (byte)*_line;
+		}
+		hash *= 0x0193;
+	}
+
+	if (_line == _end || *_separators != '\0')
+		return NULL;
+
+	hash ^= 0xFF;
+	*_hash = hash * 0x0193;
+	return _line + 1;
+}
+
+/**
+ * \brief       Skip a line which must start with a prefix
+ * \return   the character after the prefix, NULL if the line does not start with it.
+ */
+static const char *SkipPrefix_P(const char *_line, const char *_end, const PROGMEM char *_prefix)
+{
+	int length = strlen_P(_prefix);
+
+	if (_end - _line < length || memcmp_P(_line, _prefix, length) != 0)
+		return NULL;
+
+	return _line + length;
+}
+
+/**
+ * \brief       Skip to the next line
+ */
+static const char *NextLine(const char *_line, const char *_end)
+{
+	const char *eol = (const char *)memchr(_line, '\n', _end - _line);
+	return eol == NULL ? NULL : eol + 1;
+}
+
+/**
+ * \brief       Convert a decimal number ("-21.5") to fixed point
+ * \param    _value         first character of the number
+ * \param    _end           end of the number
+ * \param    _decimals      number of decimals kept, the others are truncated
+ * \return   the value times 10^_decimals, XPL_BATCH_BAD_VALUE if it is not a number or is too large.
+ */
+static long ParseFixed(const char *_value, const char *_end, byte _decimals)
+{
+	bool negative = false;
+	bool digits = false;
+	bool point = false;
+	unsigned long result = 0;
+
+	if (_value < _end && (*_value == '-' || *_value == '+'))
+	{
+		negative = (*_value == '-');
+		_value++;
+	}
+
+	for (; _value < _end; _value++)
+	{
+		if (*_value == '.' && !point)
+		{
+			point = true;
+			continue;
+		}
+
+		if (*_value < '0' || *_value > '9')
+			return XPL_BATCH_BAD_VALUE;
+
+		digits = true;
+
+		if (point)
+		{
+			if (_decimals == 0)
+				continue;  // truncated
+			_decimals--;
+		}
+
+		// the markers stay out of the range of the values
+		if (result > (2147483646UL - (*_value - '0')) / 10)
+			return XPL_BATCH_BAD_VALUE;
+		result = result * 10 + (*_value - '0');
+	}
+
+	if (!digits)
+		return XPL_BATCH_BAD_VALUE;
+
+	for (; _decimals > 0; _decimals--)
+	{
+		if (result > 2147483646UL / 10)
+			return XPL_BATCH_BAD_VALUE;
+		result *= 10;
+	}
+
+	return negative ? -(long)result : (long)result;
+}
+
+/**
+ * \brief       Decode a packet into the row "rows" of the columns
+ * \return   false if the packet is malformed.
+ */
+bool xPL_Batch::DecodePacket(const char *_packet)
+{
+	const char *line = _packet;
+	const char *end = _packet + strnlen(_packet, XPL_MESSAGE_BUFFER_MAX);
+	unsigned int source_hash;
+	unsigned int schema_hash;
+	byte packet_type;
+
+	// xpl-cmnd, xpl-stat or xpl-trig
+	if ((line = SkipPrefix_P(line, end, PSTR("xpl-"))) == NULL || end - line < 5 || line[4] != '\n')
+		return false;
+
+	if (memcmp_P(line, PSTR("cmnd"), 4) == 0) packet_type = XPL_CMND;
+	else if (memcmp_P(line, PSTR("stat"), 4) == 0) packet_type = XPL_STAT;
+	else if (memcmp_P(line, PSTR("trig"), 4) == 0) packet_type = XPL_TRIG;
+	else return false;
+
+	// header: "{", hop, source, target, "}"
+	if ((line = SkipPrefix_P(line + 5, end, PSTR("{\n"))) == NULL
+		|| (line = SkipPrefix_P(line, end, PSTR("hop="))) == NULL
+		|| (line = NextLine(line, end)) == NULL
+		|| (line = SkipPrefix_P(line, end, PSTR("source="))) == NULL
+		|| (line = HashFields(line, end, "-.", &source_hash)) == NULL
+		|| (line = SkipPrefix_P(line, end, PSTR("target="))) == NULL
+		|| (line = NextLine(line, end)) == NULL
+		|| (line = SkipPrefix_P(line, end, PSTR("}\n"))) == NULL
+		|| (line = HashFields(line, end, ".", &schema_hash)) == NULL
+		|| (line = SkipPrefix_P(line, end, PSTR("{\n"))) == NULL)
+	{
+		return false;
+	}
+
+	for (byte c = 0; c < column_count; c++)
+	{
+		value[c][rows] = XPL_BATCH_NO_VALUE;
+	}
+
+	// body: only the selected commands are converted
+	while (line < end && *line != '}')
+	{
+		const char *eol = (const char *)memchr(line, '\n', end - line);
+		if (eol == NULL)
+			return false;
+
+		const char *equal = (const char *)memchr(line, '=', eol - line);
+		if (equal != NULL)
+		{
+			int length = equal - line;
+
+			for (byte c = 0; c < column_count && length <= XPL_NAME_LENGTH_MAX; c++)
+			{
+				if (column_name[c][length] == '\0' && memcmp(column_name[c], line, length) == 0)
+				{
+					value[c][rows] = ParseFixed(equal + 1, eol, column_decimals[c]);
+					break;
+				}
+			}
+		}
+
+		line = eol + 1;
+	}
+
+	if (line == end)
+		return false;  // end of schema not found
+
+	if (type != NULL) type[rows] = packet_type;
+	if (source_id != NULL) source_id[rows] = source_hash;
+	if (schema_id != NULL) schema_id[rows] = schema_hash;
+	return true;
+}
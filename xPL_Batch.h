@@ -0,0 +1,65 @@
+/*
+ * xPL.Arduino v0.1, xPL Implementation for Arduino
+ *
+ * This code is parsing a xPL message stored in 'received' buffer
+ * - isolate and store in 'line' buffer each part of the message -> detection of EOL character (DEC 10)
+ * - analyse 'line', function of its number and store information in xpl_header memory
+ * - check for each step if the message respect xPL protocol
+ * - parse each command line
+ *
+ * Copyright (C) 2012 johan@pirlouit.ch, olivier.lebrun@gmail.com
+ * Original version by Gromain59@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef xPLBatch_h
+#define xPLBatch_h
+
+#include "Arduino.h"
+#include "xPL_utils.h"
+#include "xPL_Message.h"
+
+#define XPL_BATCH_COLUMN_MAX	4				// number of command values decoded per packet
+#define XPL_BATCH_NO_VALUE		(-2147483647L - 1)	// value of a command missing from a packet
+#define XPL_BATCH_BAD_VALUE		(-2147483647L)		// value of a command which is not a number
+
+class xPL_Batch
+{
+    public:
+        xPL_Batch();
+
+        // output columns, one row per decoded packet, NULL if not wanted
+        byte *type;					// XPL_CMND, XPL_STAT or XPL_TRIG
+        unsigned int *source_id;	// hashId of the source
+        unsigned int *schema_id;	// hashSchema of the schema
+        long *value[XPL_BATCH_COLUMN_MAX];  // values of the selected commands, in fixed point
+
+        int capacity;				// number of rows of the columns
+        int rows;					// number of rows decoded
+        int consumed;				// number of packets read by the last Decode, malformed ones included
+
+        bool SelectColumn_P(const PROGMEM char *, long *, byte = 0);
+        int Decode(char **, int);
+
+    private:
+        char column_name[XPL_BATCH_COLUMN_MAX][XPL_NAME_LENGTH_MAX+1];
+        byte column_decimals[XPL_BATCH_COLUMN_MAX];
+        byte column_count;
+
+        bool DecodePacket(const char *);
+};
+
+#endif
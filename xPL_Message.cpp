@@ -29,8 +29,14 @@
 
 xPL_Message::xPL_Message()
 {
+    type = 0;
+    hop = 0;
+    source.vendor_id[0] = source.device_id[0] = source.instance_id[0] = '\0';
+    target.vendor_id[0] = target.device_id[0] = target.instance_id[0] = '\0';
+    schema.class_id[0] = schema.type_id[0] = '\0';
     command = NULL;
 	command_count = 0;
+	command_max = XPL_MESSAGE_COMMAND_MAX;
 }
 
 xPL_Message::~xPL_Message()
@@ -88,8 +94,8 @@ bool xPL_Message::CreateCommand()
 	struct_command	*ncommand;
 
 	// Maximun command reach
-	// To avoid oom, we arbitrary accept only XPL_MESSAGE_COMMAND_MAX command
-	if(command_count > XPL_MESSAGE_COMMAND_MAX)
+	// To avoid oom, we arbitrary accept only command_max command
+	if(command_count > command_max)
 		return false;
 		
 	ncommand = (struct_command*)realloc ( command, (command_count + 1) * sizeof(struct_command) );
@@ -142,10 +148,10 @@ bool xPL_Message::AddCommand(char* _name, char* _value)
  */
 char* xPL_Message::toString()
 {
-  char *message_buffer = malloc(XPL_MESSAGE_BUFFER_MAX);
+  char *message_buffer = malloc(Length() + 1);
   int pos = 0;
 
-  clearStr(message_buffer);
+  message_buffer[0] = '\0';
 
   switch(type)
   {
@@ -183,6 +189,32 @@ char* xPL_Message::toString()
   return message_buffer;
 }
 
+/**
+ * \brief       Length of the message converted by toString, without the end of string
+ */
+unsigned int xPL_Message::Length()
+{
+  unsigned int len = 8 + 16 + strlen(source.vendor_id) + 1 + strlen(source.device_id) + 1 + strlen(source.instance_id) + 8;
+
+  if(memcmp(target.vendor_id,"*", 1) == 0)  // check if broadcast message
+  {
+    len += 4;
+  }
+  else
+  {
+    len += strlen(target.vendor_id) + 1 + strlen(target.device_id) + 1 + strlen(target.instance_id) + 3;
+  }
+
+  len += strlen(schema.class_id) + 1 + strlen(schema.type_id) + 3;
+
+  for (byte i=0; i<command_count; i++)
+  {
+    len += strlen(command[i].name) + 1 + strlen(command[i].value) + 1;
+  }
+
+  return len + 2;
+}
+
 bool xPL_Message::IsSchema(char* _classId, char* _typeId)
 {
   if (strcmp(schema.class_id, _classId) == 0)
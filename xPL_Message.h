@@ -50,6 +50,7 @@ class xPL_Message
         struct_xpl_schema schema;
         struct_command *command;
         byte command_count;
+        byte command_max;		// default XPL_MESSAGE_COMMAND_MAX
 
         bool AddCommand_P(const PROGMEM char *,const PROGMEM char *);
 		bool AddCommand(char*, char*);
@@ -58,6 +59,7 @@ class xPL_Message
         ~xPL_Message();
 
         char *toString();
+        unsigned int Length();
         
         bool IsSchema(char*, char*);
         bool IsSchema_P(const PROGMEM char*, const PROGMEM char*);
@@ -0,0 +1,168 @@
+/*
+ * xPL.Arduino v0.1, xPL Implementation for Arduino
+ *
+ * This code is parsing a xPL message stored in 'received' buffer
+ * - isolate and store in 'line' buffer each part of the message -> detection of EOL character (DEC 10)
+ * - analyse 'line', function of its number and store information in xpl_header memory
+ * - check for each step if the message respect xPL protocol
+ * - parse each command line
+ *
+ * Copyright (C) 2012 johan@pirlouit.ch, olivier.lebrun@gmail.com
+ * Original version by Gromain59@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "xPL_Recorder.h"
+
+// a record is the millis() of reception, the packet length and the packet with its end of string
+#define XPL_RECORD_HEADER	(sizeof(unsigned long) + sizeof(unsigned int))
+
+xPL_Recorder::xPL_Recorder()
+{
+	log = NULL;
+	log_size = 0;
+	index = NULL;
+	index_size = 0;
+	Clear();
+}
+
+/**
+ * \brief       Set the memory of the recorder
+ * \details   The log is append only and may be any byte region: an array in RAM, or on a host
+ *                a memory-mapped file, so that the records outlive the program.
+ * \param    _log                 the log of the packets.
+ * \param    _log_size          size of the log, in bytes.
+ * \param    _index              the index of the packets, one entry per packet.
+ * \param    _index_size       number of entries of the index.
+ */
+void xPL_Recorder::Begin(byte *_log, unsigned int _log_size, struct_record_index *_index, unsigned int _index_size)
+{
+	log = _log;
+	log_size = _log_size;
+	index = _index;
+	index_size = _index_size;
+	Clear();
+}
+
+/**
+ * \brief       Forget all the packets recorded
+ */
+void xPL_Recorder::Clear()
+{
+	count = 0;
+	used = 0;
+}
+
+/**
+ * \brief       Append a received packet to the log
+ * \details   Meant to be called from the xPL ReceiveAction callback.
+ * \param    _buffer         the packet.
+ * \param    _message      the packet parsed, to index it by source and schema.
+ * \return   false if the log or the index is full.
+ */
+bool xPL_Recorder::Record(char *_buffer, xPL_Message *_message)
+{
+	unsigned int length = strlen(_buffer) + 1;
+
+	if (count == index_size || XPL_RECORD_HEADER + length > log_size - used)
+		return false;
+
+	unsigned long time = millis();
+	memcpy(log + used, &time, sizeof(time));
+	memcpy(log + used + sizeof(time), &length, sizeof(length));
+	memcpy(log + used + XPL_RECORD_HEADER, _buffer, length);
+
+	index[count].source_key = hashId(0, &_message->source);
+	index[count].schema_key = hashSchema(0, &_message->schema);
+	index[count].offset = used;
+
+	used += XPL_RECORD_HEADER + length;
+	count++;
+	return true;
+}
+
+/**
+ * \brief       Push the recorded packets back through ParseInputMessage
+ * \details   ReceiveAction is detached during the replay, so the replayed packets are not
+ *                recorded again even if it points to Record.
+ * \param    _xpl              the xPL receiving the packets.
+ * \param    _realtime      if true, keep the delays between the packets (Process() is called while waiting),
+ *                                  else replay as fast as possible.
+ */
+void xPL_Recorder::Replay(xPL *_xpl, bool _realtime)
+{
+	unsigned long start = millis();
+	unsigned int packets = count;
+	xPLReceiveAction receive = _xpl->ReceiveAction;
+	_xpl->ReceiveAction = NULL;
+
+	for (unsigned int i = 0; i < packets; i++)
+	{
+		if (_realtime)
+		{
+			while (millis() - start < Time(i) - Time(0))
+			{
+				_xpl->Process();
+			}
+		}
+
+		_xpl->ParseInputMessage(Packet(i));
+	}
+
+	_xpl->ReceiveAction = receive;
+}
+
+/**
+ * \brief       Find the next packet of a source and/or a schema
+ * \param    _from                first packet to check.
+ * \param    _source_key      hashId of the source, 0 for any.
+ * \param    _schema_key     hashSchema of the schema, 0 for any.
+ * \return   the packet number, or -1 if none.
+ */
+int xPL_Recorder::Find(int _from, unsigned int _source_key, unsigned int _schema_key)
+{
+	for (unsigned int i = _from; i < count; i++)
+	{
+		if ((_source_key == 0 || index[i].source_key == _source_key)
+			&& (_schema_key == 0 || index[i].schema_key == _schema_key))
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * \brief       Get a recorded packet, in place in the log
+ * \param    _record         the packet number.
+ */
+char *xPL_Recorder::Packet(int _record)
+{
+	return (char*)(log + index[_record].offset + XPL_RECORD_HEADER);
+}
+
+/**
+ * \brief       Get the millis() at which a packet was received
+ * \param    _record         the packet number.
+ */
+unsigned long xPL_Recorder::Time(int _record)
+{
+	unsigned long time;
+	memcpy(&time, log + index[_record].offset, sizeof(time));
+	return time;
+}
+
@@ -0,0 +1,67 @@
+/*
+ * xPL.Arduino v0.1, xPL Implementation for Arduino
+ *
+ * This code is parsing a xPL message stored in 'received' buffer
+ * - isolate and store in 'line' buffer each part of the message -> detection of EOL character (DEC 10)
+ * - analyse 'line', function of its number and store information in xpl_header memory
+ * - check for each step if the message respect xPL protocol
+ * - parse each command line
+ *
+ * Copyright (C) 2012 johan@pirlouit.ch, olivier.lebrun@gmail.com
+ * Original version by Gromain59@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef xPLRecorder_h
+#define xPLRecorder_h
+
+#include "Arduino.h"
+#include "xPL.h"
+
+typedef struct struct_record_index struct_record_index;
+struct struct_record_index		// index entry of a recorded packet
+{
+    unsigned int source_key;	// hashId of the source
+    unsigned int schema_key;	// hashSchema of the schema
+    unsigned int offset;		// offset of the record in the log
+};
+
+class xPL_Recorder
+{
+    public:
+        xPL_Recorder();
+
+        void Begin(byte *, unsigned int, struct_record_index *, unsigned int);
+        void Clear();
+
+        bool Record(char *, xPL_Message *);
+        void Replay(xPL *, bool = true);
+
+        int Find(int, unsigned int, unsigned int);
+        char *Packet(int);
+        unsigned long Time(int);
+
+        unsigned int count;		// number of packets recorded
+        unsigned int used;		// bytes used in the log
+
+    private:
+        byte *log;
+        unsigned int log_size;
+        struct_record_index *index;
+        unsigned int index_size;
+};
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * xPL.Arduino v0.1, xPL Implementation for Arduino
+ *
+ * This code is parsing a xPL message stored in 'received' buffer
+ * - isolate and store in 'line' buffer each part of the message -> detection of EOL character (DEC 10)
+ * - analyse 'line', function of its number and store information in xpl_header memory
+ * - check for each step if the message respect xPL protocol
+ * - parse each command line
+ *
+ * Copyright (C) 2012 johan@pirlouit.ch, olivier.lebrun@gmail.com
+ * Original version by Gromain59@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "xPL.h"
+
+#ifdef ENABLE_TRACE
+
+struct_trace_event xpl_trace_ring[XPL_TRACE_RING_MAX];
+volatile unsigned int xpl_trace_head = 0;
+volatile unsigned int xpl_trace_count = 0;
+
+static const char XPL_TRACE_NAME_RECEIVE[] PROGMEM = "receive";
+static const char XPL_TRACE_NAME_PARSE[] PROGMEM = "parse";
+static const char XPL_TRACE_NAME_HEADER[] PROGMEM = "header";
+static const char XPL_TRACE_NAME_COMMAND[] PROGMEM = "command";
+static const char XPL_TRACE_NAME_CALLBACK[] PROGMEM = "callback";
+static const char XPL_TRACE_NAME_SEND[] PROGMEM = "send";
+
+static const char * const XPL_TRACE_NAMES[] PROGMEM =
+{
+	XPL_TRACE_NAME_RECEIVE,
+	XPL_TRACE_NAME_PARSE,
+	XPL_TRACE_NAME_HEADER,
+	XPL_TRACE_NAME_COMMAND,
+	XPL_TRACE_NAME_CALLBACK,
+	XPL_TRACE_NAME_SEND
+};
+
+/**
+ * \brief       Write the traced events in Chrome trace format
+ * \details   The output can be saved in a .json file and opened with chrome://tracing or Perfetto.
+ *                The events are written from the oldest to the newest, and the ring is not cleared.
+ * \param    _output         where to write, Serial for instance.
+ */
+void xPL_TraceDump(Print &_output)
+{
+	// the head wraps around, the count tells how many events are valid
+	unsigned int count = xpl_trace_count;
+	unsigned int first = xpl_trace_head - count;
+	char buffer[80];
+
+	_output.print(F("{\"traceEvents\":["));
+
+	for (unsigned int n = 0; n < count; n++)
+	{
+		struct_trace_event *event = &xpl_trace_ring[(first + n) & (XPL_TRACE_RING_MAX - 1)];
+		char name[10];
+		strcpy_P(name, (const char *)pgm_read_word(&XPL_TRACE_NAMES[event->stage]));
+
+		sprintf_P(buffer, PSTR("%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lu,\"pid\":1,\"tid\":1,\"args\":{\"n\":%d}}"),
+			n == 0 ? "" : ",", name, event->phase, event->time, event->arg);
+		_output.print(buffer);
+	}
+
+	_output.println(F("\n]}"));
+}
+
+/**
+ * \brief       Forget the traced events
+ */
+void xPL_TraceClear()
+{
+	xpl_trace_head = 0;
+	xpl_trace_count = 0;
+}
+
+#endif
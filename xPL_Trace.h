@@ -0,0 +1,85 @@
+/*
+ * xPL.Arduino v0.1, xPL Implementation for Arduino
+ *
+ * This code is parsing a xPL message stored in 'received' buffer
+ * - isolate and store in 'line' buffer each part of the message -> detection of EOL character (DEC 10)
+ * - analyse 'line', function of its number and store information in xpl_header memory
+ * - check for each step if the message respect xPL protocol
+ * - parse each command line
+ *
+ * Copyright (C) 2012 johan@pirlouit.ch, olivier.lebrun@gmail.com
+ * Original version by Gromain59@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef xPLTrace_h
+#define xPLTrace_h
+
+#include "Arduino.h"
+
+#define XPL_TRACE_RING_MAX	64	// number of events kept, must be a power of 2
+
+// traced stages
+#define XPL_TRACE_RECEIVE	0	// ParseInputMessage
+#define XPL_TRACE_PARSE		1	// Parse, the line loop
+#define XPL_TRACE_HEADER	2	// AnalyseHeaderLine, arg is the line number
+#define XPL_TRACE_COMMAND	3	// AnalyseCommandLine, arg is the command number
+#define XPL_TRACE_CALLBACK	4	// AfterParseAction
+#define XPL_TRACE_SEND		5	// SendExternal
+
+#define XPL_TRACE_BEGIN		'B'
+#define XPL_TRACE_END		'E'
+
+#ifdef ENABLE_TRACE
+
+typedef struct struct_trace_event struct_trace_event;
+struct struct_trace_event
+{
+    unsigned long time;		// micros()
+    byte stage;
+    char phase;				// XPL_TRACE_BEGIN or XPL_TRACE_END
+    byte arg;
+};
+
+extern struct_trace_event xpl_trace_ring[XPL_TRACE_RING_MAX];
+extern volatile unsigned int xpl_trace_head;
+extern volatile unsigned int xpl_trace_count;	// valid events in the ring, up to XPL_TRACE_RING_MAX
+
+// Record an event, overwriting the oldest one.
+// There is only one writer (the main loop), so no lock is needed.
+inline void xPL_TraceEvent(byte _stage, char _phase, byte _arg)
+{
+    struct_trace_event *event = &xpl_trace_ring[xpl_trace_head & (XPL_TRACE_RING_MAX - 1)];
+    event->time = micros();
+    event->stage = _stage;
+    event->phase = _phase;
+    event->arg = _arg;
+    xpl_trace_head++;
+    if (xpl_trace_count < XPL_TRACE_RING_MAX) xpl_trace_count++;
+}
+
+void xPL_TraceDump(Print &);
+void xPL_TraceClear();
+
+#define XPL_TRACE(_stage, _phase, _arg)		xPL_TraceEvent(_stage, _phase, _arg)
+
+#else
+
+#define XPL_TRACE(_stage, _phase, _arg)
+
+#endif
+
+#endif
@@ -36,3 +36,40 @@ void clearStr (char* str)
         str[c] = 0;
     }
 }
+
+// Function to hash a string, chained from a previous hash (FNV-1a like)
+unsigned int hashStr (unsigned int hash, const char* str)
+{
+    while (*str)
+    {
+        hash ^= (byte)*str++;
+        hash *= 0x0193;
+    }
+    // separator, so that "ab"+"c" and "a"+"bc" differ
+    hash ^= 0xFF;
+    hash *= 0x0193;
+    return hash;
+}
+
+// Function to hash a source or target, chained from a previous hash
+unsigned int hashId (unsigned int hash, const struct_id* id)
+{
+    return hashStr(hashStr(hashStr(hash, id->vendor_id), id->device_id), id->instance_id);
+}
+
+// Function to hash a schema, chained from a previous hash
+unsigned int hashSchema (unsigned int hash, const struct_xpl_schema* schema)
+{
+    return hashStr(hashStr(hash, schema->class_id), schema->type_id);
+}
+
+// Function to hash a block of memory, chained from a previous hash
+unsigned int hashBlock (unsigned int hash, const byte* block, unsigned int length)
+{
+    while (length--)
+    {
+        hash ^= *block++;
+        hash *= 0x0193;
+    }
+    return hash;
+}
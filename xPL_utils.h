@@ -39,7 +39,7 @@
 #define XPL_NAME_LENGTH_MAX		16
 #define XPL_VALUE_LENGTH_MAX	32  // should be 128 but need to spare RAM
 
-#define	XPL_HOP_COUNT_PARSER	PSTR("hop=%d")
+#define	XPL_HOP_COUNT_PARSER	PSTR("hop=%hd")
 #define	XPL_SOURCE_PARSER		PSTR("source=%8[^-]-%8[^'.'].%16s")
 #define	XPL_TARGET_PARSER		PSTR("target=%8[^-]-%8[^'.'].%16s")
 #define	XPL_SCHEMA_PARSER		PSTR("%8[^'.'].%8s")
@@ -67,6 +67,20 @@ struct struct_command			// source or target
     char value[XPL_VALUE_LENGTH_MAX+1];		// device id
 };
 
+typedef struct struct_published struct_published;
+struct struct_published			// last value published for a schema and a device
+{
+    unsigned int key;			// hash of schema and device
+    struct_xpl_schema schema;
+    char device[XPL_VALUE_LENGTH_MAX+1];
+    long value;					// last value sent
+    unsigned long last_sent;	// millis() of the last send
+};
+
 void clearStr (char* str);
+unsigned int hashStr (unsigned int hash, const char* str);
+unsigned int hashId (unsigned int hash, const struct_id* id);
+unsigned int hashSchema (unsigned int hash, const struct_xpl_schema* schema);
+unsigned int hashBlock (unsigned int hash, const byte* block, unsigned int length);
 
 #endif